@@ -0,0 +1,575 @@
+#pragma once
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <span>
+#include <optional>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include "Globals.h"
+#include "Task.h"
+#include "TransitionTable.h"
+#include "Timing.h"
+#include "PerfCounters.h"
+#include "Timer.h"
+#include "Hybrid.h"
+
+//Meta engine. Which fixed engine wins depends on how the heavy tasks are spread and how heavy they are, so this one measures task and
+//scheduling costs while it runs, and before every chunk picks the schedule and grain with the shortest makespan predicted from the chunks before it.
+namespace adaptive
+{
+	using Clock = std::chrono::steady_clock;
+
+	enum class Schedule
+	{
+		Static, //Preassigned subsets, no synchronization per task.
+		Dynamic, //One shared counter, claimed a grain at a time. Grain 1 is AtomicQueued.
+		Steal, //Preassigned subsets claimed a grain at a time, stealing once a worker runs dry. The hybrid engine.
+		Count
+	};
+
+	inline constexpr std::array<const char*, size_t(Schedule::Count)> ScheduleNames = { "static", "dynamic", "steal" };
+
+	//Every SampleEvery-th task and claim of a worker gets timed. Often enough to follow the data, rare enough that the clock reads don't show.
+	inline constexpr size_t SampleEvery = 16;
+
+	struct Plan
+	{
+		Schedule schedule = Schedule::Static;
+		uint32_t grain = SUBSET_SIZE;
+		float predictedTime = 0.f; //Microseconds, 0 while the model is still trying things out.
+	};
+
+	//What one worker measured during a chunk, in microseconds. The sampled tasks are also counted by the subset they sit in, not by who ran them,
+	//so how the work spreads over the static split's subsets is known whatever schedule the chunk ran under.
+	struct Samples
+	{
+		std::array<double, 2> taskTime{}; //Light, heavy.
+		std::array<size_t, 2> taskIterations{}; //Of the timed tasks, so the model can work per iteration.
+		std::array<size_t, WORKER_COUNT> subsetTasks{};
+		std::array<std::array<size_t, 2>, WORKER_COUNT> subsetIterations{}; //Light, heavy.
+		double claimTime = 0.;
+		size_t claimCount = 0;
+
+		Samples& operator+=(const Samples& rhs)
+		{
+			for (size_t i = 0; i < 2; i++)
+			{
+				taskTime[i] += rhs.taskTime[i];
+				taskIterations[i] += rhs.taskIterations[i];
+			}
+			for (size_t w = 0; w < WORKER_COUNT; w++)
+			{
+				subsetTasks[w] += rhs.subsetTasks[w];
+				for (size_t i = 0; i < 2; i++)
+				{
+					subsetIterations[w][i] += rhs.subsetIterations[w][i];
+				}
+			}
+			claimTime += rhs.claimTime;
+			claimCount += rhs.claimCount;
+			return *this;
+		}
+	};
+
+	//Exponentially weighted averages of what an iteration of a light task, of a heavy task and a claim under each schedule cost, and of how many
+	//iterations of each class a task in each subset has, and the makespan predictions built from them. Per iteration, so the predictions follow
+	//the counts when the workload has more than two of them. Still two classes, since with the transition table an iteration of a heavy task
+	//is much cheaper than one of a light task. Only chunks that already ran feed it, the tasks of the chunk about to run are never looked at.
+	//Reading their costs off them would be knowing the answer in advance, which a real scheduler can't.
+	class CostModel
+	{
+	public:
+		static constexpr double Smoothing = .25; //Weight of the newest chunk, so a drift in the data shows up within a few chunks.
+		static constexpr std::array<uint32_t, 5> Grains = { 1, 4, 16, 64, 256 };
+
+		void Update(Schedule schedule, const Samples& samples)
+		{
+			for (size_t i = 0; i < 2; i++)
+			{
+				Blend_(m_taskCost[i], samples.taskTime[i], samples.taskIterations[i]);
+			}
+			for (size_t w = 0; w < WORKER_COUNT; w++)
+			{
+				for (size_t i = 0; i < 2; i++)
+				{
+					Blend_(m_subsetIterations[w][i], double(samples.subsetIterations[w][i]), samples.subsetTasks[w]);
+				}
+			}
+			if (schedule != Schedule::Static)
+			{
+				Blend_(m_claimCost[size_t(schedule)], samples.claimTime, samples.claimCount);
+			}
+		}
+
+		//Waking the workers and waiting for the last one costs about the same whatever the schedule. It's whatever part of the chunk time
+		//the task and claim costs don't explain, and it makes the predictions comparable to the measured chunk times.
+		void UpdateOverhead(const Plan& plan, float chunkTime)
+		{
+			if (plan.predictedTime <= 0.f) return;
+			Blend_(m_overhead, chunkTime - (plan.predictedTime - m_overhead.value_or(0.)), 1);
+		}
+
+		//Only takes the size of the chunk, see above.
+		Plan Choose(size_t taskCount) const
+		{
+			//Until there's a measurement for everything, try each schedule once.
+			if (!m_taskCost[0] && !m_taskCost[1]) return { Schedule::Static, SUBSET_SIZE };
+			if (!m_claimCost[size_t(Schedule::Dynamic)]) return { Schedule::Dynamic, hybrid::ClaimGrain };
+			if (!m_claimCost[size_t(Schedule::Steal)]) return { Schedule::Steal, hybrid::ClaimGrain };
+
+			//A class we haven't seen yet costs what the other one does.
+			const double light = m_taskCost[0].value_or(m_taskCost[1].value_or(0.));
+			const double heavy = m_taskCost[1].value_or(light);
+			//A subset nothing was sampled in yet has the iterations of the others.
+			std::array<double, 2> seenIterations{};
+			size_t seen = 0;
+			for (const auto& iterations : m_subsetIterations)
+			{
+				if (!iterations[0]) continue;
+				seenIterations[0] += *iterations[0];
+				seenIterations[1] += *iterations[1];
+				seen++;
+			}
+
+			const double subsetTasks = double(taskCount) / WORKER_COUNT;
+			std::array<double, WORKER_COUNT> subsetCost{};
+			double total = 0.;
+			for (size_t w = 0; w < WORKER_COUNT; w++)
+			{
+				const auto iterations = [&](size_t i) { return m_subsetIterations[w][i].value_or(seen ? seenIterations[i] / double(seen) : 0.); };
+				subsetCost[w] = subsetTasks * (iterations(0) * light + iterations(1) * heavy);
+				total += subsetCost[w];
+			}
+			const double perWorker = total / WORKER_COUNT + m_overhead.value_or(0.);
+			const double average = taskCount == 0 ? 0. : total / double(taskCount);
+
+			Plan best{ Schedule::Static, SUBSET_SIZE, float(*std::ranges::max_element(subsetCost) + m_overhead.value_or(0.)) };
+			const auto consider = [&best](Schedule schedule, uint32_t grain, double predicted) {
+				if (predicted < best.predictedTime)
+				{
+					best = { schedule, grain, float(predicted) };
+				}
+			};
+			const double dynamicClaim = *m_claimCost[size_t(Schedule::Dynamic)];
+			const double stealClaim = *m_claimCost[size_t(Schedule::Steal)];
+			for (const uint32_t grain : Grains)
+			{
+				//Shared counter: perfectly even, plus this worker's share of the claims, plus up to a grain of tail on whoever takes the last one.
+				consider(Schedule::Dynamic, grain, perWorker + subsetTasks / grain * dynamicClaim + grain * average);
+				//Stealing: even after about log2(workers) rounds of halving, claims only on the own range.
+				const double steals = double(std::bit_width(WORKER_COUNT));
+				consider(Schedule::Steal, grain, perWorker + (subsetTasks / grain + steals) * stealClaim + grain * average);
+			}
+			return best;
+		}
+
+		void Print() const
+		{
+			const auto print = [](const char* name, const std::optional<double>& estimate) {
+				if (estimate)
+				{
+					printf("%s %f microseconds \n", name, *estimate);
+				}
+			};
+			print("Light task iteration:", m_taskCost[0]);
+			print("Heavy task iteration:", m_taskCost[1]);
+			print("Dynamic claim:", m_claimCost[size_t(Schedule::Dynamic)]);
+			print("Steal claim:", m_claimCost[size_t(Schedule::Steal)]);
+			print("Chunk overhead:", m_overhead);
+			for (size_t w = 0; w < WORKER_COUNT; w++)
+			{
+				if (m_subsetIterations[w][0])
+				{
+					printf("Subset %zu: %f light and %f heavy iterations per task \n", w, *m_subsetIterations[w][0], *m_subsetIterations[w][1]);
+				}
+			}
+		}
+
+	private:
+		static void Blend_(std::optional<double>& estimate, double sum, size_t count)
+		{
+			if (count == 0) return;
+			const double measured = sum / double(count);
+			estimate = estimate ? *estimate + Smoothing * (measured - *estimate) : measured;
+		}
+
+		std::array<std::optional<double>, 2> m_taskCost; //Per iteration, light, heavy.
+		std::array<std::array<std::optional<double>, 2>, WORKER_COUNT> m_subsetIterations; //Per task, light, heavy.
+		std::array<std::optional<double>, size_t(Schedule::Count)> m_claimCost; //Static never claims.
+		std::optional<double> m_overhead;
+	};
+
+	class ControlObject
+	{
+	public:
+		ControlObject() : m_lk{ m_mtx }
+		{
+
+		}
+
+		void SignalDone()
+		{
+			bool needsNotification = false;
+			{
+				std::lock_guard lk {m_mtx};
+				m_doneCount++;
+
+				//Has to happen while the mutex is still held, so there's no race condition
+				if (m_doneCount == WORKER_COUNT)
+				{
+					//Notify the condition variable of this thread.
+					needsNotification = true;
+				}
+			}
+			if (needsNotification)
+			{
+				m_cv.notify_one();
+			}
+		}
+
+		void WaitForAllDone()
+		{
+			//Wait until work is done.
+			m_cv.wait(m_lk, [this] {return m_doneCount == WORKER_COUNT; });
+			m_doneCount = 0;
+		}
+
+		//Happens before the workers are started, so their mutex hands the plan and the reset counters over.
+		void SetChunk(std::span<const Task> chunk, Plan plan)
+		{
+			m_currentChunk = chunk;
+			m_plan = plan;
+			m_next.store(0, std::memory_order_relaxed);
+			m_ranges.Reset();
+		}
+
+		const Plan& GetPlan() const
+		{
+			return m_plan;
+		}
+
+		const Task& GetTask(uint32_t index) const
+		{
+			return m_currentChunk[index];
+		}
+
+		//Dynamic schedule, the next grain off the shared counter.
+		hybrid::StealableRange::Bounds ClaimShared(uint32_t grain)
+		{
+			const uint32_t size = uint32_t(m_currentChunk.size());
+			const uint32_t front = m_next.fetch_add(grain, std::memory_order_relaxed);
+			return { std::min(front, size), std::min(front + grain, size) };
+		}
+
+		hybrid::RangeSet& GetRanges()
+		{
+			return m_ranges;
+		}
+
+	private:
+		std::condition_variable m_cv;
+		std::mutex m_mtx;
+		std::unique_lock<std::mutex> m_lk;
+		std::span<const Task> m_currentChunk; //Basically a flexible array.
+		Plan m_plan;
+		//SharedMemory
+		int m_doneCount = 0;
+		alignas(64) std::atomic<uint32_t> m_next = 0;
+		hybrid::RangeSet m_ranges;
+	};
+
+	class Worker
+	{
+	public:
+		Worker(ControlObject* control, size_t index) : m_PControl{ control }, m_index{ index }, m_thread{ &Worker::Run, this }
+		{
+
+		}
+
+		void StartWork()
+		{
+			{
+				std::lock_guard lk {m_mtx};
+				m_working = true;
+			}
+			m_cv.notify_one();
+		}
+
+		void Kill()
+		{
+			{
+				std::lock_guard lk {m_mtx};
+				m_threadDying = true;
+			}
+
+			m_cv.notify_one();
+		}
+
+		float GetJobWorkTime() const
+		{
+			return m_workTime;
+		}
+
+		double GetResult() const
+		{
+			return m_accumulate;
+		}
+
+		size_t GetNumHeavyItemsProcessed() const
+		{
+			return m_heavyItemsProcessed;
+		}
+
+		PerfSample GetChunkCounters() const
+		{
+			return m_chunkCounters;
+		}
+
+		const Samples& GetSamples() const
+		{
+			return m_samples;
+		}
+
+		~Worker()
+		{
+			Kill();
+		}
+
+	private:
+		void ProcessData_()
+		{
+			m_heavyItemsProcessed = 0;
+			m_samples = {};
+			const auto plan = m_PControl->GetPlan();
+			switch (plan.schedule)
+			{
+			case Schedule::Static:
+				RunRange_(uint32_t(m_index * SUBSET_SIZE), uint32_t((m_index + 1) * SUBSET_SIZE));
+				break;
+			case Schedule::Dynamic:
+				for (auto claim = TimedClaim_([&] { return m_PControl->ClaimShared(plan.grain); }); claim.Size() > 0;
+					claim = TimedClaim_([&] { return m_PControl->ClaimShared(plan.grain); }))
+				{
+					RunRange_(claim.front, claim.back);
+				}
+				break;
+			case Schedule::Steal:
+			{
+				auto& ranges = m_PControl->GetRanges();
+				auto& range = ranges.GetRange(m_index);
+				do
+				{
+					for (auto claim = TimedClaim_([&] { return range.ClaimFront(plan.grain); }); claim.Size() > 0;
+						claim = TimedClaim_([&] { return range.ClaimFront(plan.grain); }))
+					{
+						RunRange_(claim.front, claim.back);
+					}
+				} while (ranges.Steal(m_index));
+				break;
+			}
+			default:
+				break;
+			}
+		}
+
+		void RunRange_(uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; i++)
+			{
+				const auto& task = m_PControl->GetTask(i);
+				if (m_tasksSeen++ % SampleEvery == 0)
+				{
+					const auto start = Clock::now();
+					m_accumulate += ProcessTask(task);
+					m_samples.taskTime[task.heavy] += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+					m_samples.taskIterations[task.heavy] += task.iterations;
+					const size_t subset = std::min(i / SUBSET_SIZE, WORKER_COUNT - 1);
+					m_samples.subsetTasks[subset]++;
+					m_samples.subsetIterations[subset][task.heavy] += task.iterations;
+				}
+				else
+				{
+					m_accumulate += ProcessTask(task);
+				}
+				if constexpr (ChunkMeasurementEnabled)
+				{
+					m_heavyItemsProcessed += task.heavy ? 1 : 0;
+				}
+			}
+		}
+
+		template<typename F>
+		hybrid::StealableRange::Bounds TimedClaim_(F&& claim)
+		{
+			if (m_claimsSeen++ % SampleEvery != 0) return claim();
+			const auto start = Clock::now();
+			const auto bounds = claim();
+			m_samples.claimTime += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+			m_samples.claimCount++;
+			return bounds;
+		}
+
+		//Run is the while loop happening on the thread. The other functions here are interface functions abstracted, and happen from the main thread.
+		void Run()
+		{
+			std::unique_lock lk {m_mtx};
+			Timer localTimer;
+			std::optional<PerfCounters> counters; //Opened on this thread, so it counts this worker only.
+			PerfSample chunkStart;
+			if constexpr (ChunkMeasurementEnabled && PerfCountersEnabled)
+			{
+				counters.emplace();
+			}
+			while (true)
+			{
+				//1. Lock. 2. Extra condition.
+				m_cv.wait(lk, [this] {return m_working || m_threadDying; }); //If working or dying, wake up.
+				if (m_threadDying) break;
+
+				if constexpr (ChunkMeasurementEnabled)
+				{
+					localTimer.StartTimer();
+					if constexpr (PerfCountersEnabled)
+					{
+						chunkStart = counters->Read();
+					}
+				}
+				ProcessData_(); //Mutex remains locked when processing this.
+
+				if constexpr (ChunkMeasurementEnabled)
+				{
+					m_workTime = localTimer.GetTime();
+					if constexpr (PerfCountersEnabled)
+					{
+						m_chunkCounters = counters->Read() - chunkStart;
+					}
+				}
+
+				m_working = false;
+				m_PControl->SignalDone();
+			}
+		}
+
+		ControlObject* m_PControl;
+		size_t m_index;
+		std::condition_variable m_cv;
+		std::mutex m_mtx;
+
+		//Shared memory.
+		unsigned int m_accumulate = 0;
+		bool m_threadDying = false;
+		float m_workTime = -1.f;
+		size_t m_heavyItemsProcessed = 0;
+		PerfSample m_chunkCounters;
+		Samples m_samples;
+		size_t m_tasksSeen = 0;
+		size_t m_claimsSeen = 0;
+		bool m_working = false;
+		std::jthread m_thread; //Declared last, so everything Run touches is constructed before the thread starts.
+	};
+
+	//Chunks can be any range of chunks, a span over a Dataset or a ChunkStream reading from disk.
+	template<typename ChunkRange>
+	int DoExperiment(ChunkRange&& chunks)
+	{
+		std::vector<ChunkTimingInfo> timings;
+		timings.reserve(CHUNK_COUNT);
+
+		Timer timer;
+		timer.StartTimer();
+
+		ControlObject mControl;
+		std::vector<std::unique_ptr<Worker>> workerPtrs(WORKER_COUNT);
+
+		for (size_t i = 0; i < WORKER_COUNT; i++)
+		{
+			workerPtrs[i] = std::make_unique<Worker>(&mControl, i);
+		}
+
+		CostModel model;
+		std::map<std::pair<Schedule, uint32_t>, size_t> decisions;
+		double predictionError = 0.;
+		size_t predictions = 0;
+		Timer chunkTimer;
+
+		for (const auto& chunk : chunks)
+		{
+			//Always timed, the prediction error says whether the model is any good.
+			chunkTimer.StartTimer();
+			const Plan plan = model.Choose(std::size(chunk));
+
+			mControl.SetChunk(chunk, plan);
+			for (auto& pWorker : workerPtrs)
+			{
+				pWorker->StartWork();
+			}
+
+			mControl.WaitForAllDone(); //This guy will wake up when all jobs are done.
+			const auto chunkTime = chunkTimer.GetTime();
+
+			Samples samples;
+			for (const auto& pWorker : workerPtrs)
+			{
+				samples += pWorker->GetSamples();
+			}
+			model.Update(plan.schedule, samples);
+			model.UpdateOverhead(plan, chunkTime);
+			decisions[{ plan.schedule, plan.grain }]++;
+			if (plan.predictedTime > 0.f)
+			{
+				predictionError += std::abs(chunkTime - plan.predictedTime) / chunkTime;
+				predictions++;
+			}
+
+			if constexpr (ChunkMeasurementEnabled)
+			{
+				timings.push_back({});
+				for (size_t i = 0; i < WORKER_COUNT; i++)
+				{
+					timings.back().numberOfHeavyItemsPerThread[i] = workerPtrs[i]->GetNumHeavyItemsProcessed();
+					timings.back().timeSpentWorkingPerThread[i] = workerPtrs[i]->GetJobWorkTime();
+					timings.back().countersPerThread[i] = workerPtrs[i]->GetChunkCounters();
+					timings.back().totalChunkTime = chunkTime;
+				}
+				timings.back().SetSchedule(ScheduleNames[size_t(plan.schedule)]);
+				timings.back().grain = plan.grain;
+				timings.back().predictedChunkTime = plan.predictedTime;
+			}
+		}
+
+		float timeElapsed = timer.GetTime();
+		printf("%f microseconds \n", timeElapsed);
+		for (const auto& [plan, count] : decisions)
+		{
+			printf("%s, grain %u: %zu chunks \n", ScheduleNames[size_t(plan.first)], plan.second, count);
+		}
+		printf("Average prediction error: %f%% \n", predictions ? 100. * predictionError / double(predictions) : 0.);
+		model.Print();
+		unsigned int answer = 0.;
+		for (const auto& w : workerPtrs)
+		{
+			answer += w->GetResult();
+		}
+		std::cout << "Result is " << answer << std::endl;
+
+		//Output csv of chunk timings, with the schedule picked for every chunk.
+		// worktime, idletime, numberofheavies x workers + total time, total heavies, schedule, grain, predicted time
+		if constexpr (ChunkMeasurementEnabled)
+		{
+			WriteCSV(timings);
+		}
+
+		return 0;
+	}
+};
\ No newline at end of file
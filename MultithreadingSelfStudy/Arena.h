@@ -0,0 +1,128 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <utility>
+#include "Globals.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+//One big block of zeroed memory straight from the OS, for data that lives as long as an experiment.
+//On Linux it tries explicit huge pages first and falls back to normal pages with transparent huge pages requested,
+//so large datasets need far fewer TLB entries.
+class Arena
+{
+public:
+	enum class PageKind
+	{
+		Normal,
+		TransparentHuge, //Asked for with madvise, the kernel may or may not give them.
+		ExplicitHuge //MAP_HUGETLB, needs huge pages reserved in /proc/sys/vm/nr_hugepages.
+	};
+
+	Arena() = default;
+	explicit Arena(size_t bytes)
+	{
+		Allocate_(bytes);
+	}
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+	Arena(Arena&& donor) noexcept
+		: m_data{ std::exchange(donor.m_data, nullptr) }, m_size{ std::exchange(donor.m_size, 0) }, m_mappedSize{ std::exchange(donor.m_mappedSize, 0) }, m_pageKind{ donor.m_pageKind }
+	{}
+	Arena& operator=(Arena&& rhs) noexcept
+	{
+		if (this != &rhs)
+		{
+			Release_();
+			m_data = std::exchange(rhs.m_data, nullptr);
+			m_size = std::exchange(rhs.m_size, 0);
+			m_mappedSize = std::exchange(rhs.m_mappedSize, 0);
+			m_pageKind = rhs.m_pageKind;
+		}
+		return *this;
+	}
+	~Arena()
+	{
+		Release_();
+	}
+
+	void* Data() const
+	{
+		return m_data;
+	}
+
+	size_t Size() const
+	{
+		return m_size;
+	}
+
+	PageKind GetPageKind() const
+	{
+		return m_pageKind;
+	}
+
+private:
+	static constexpr size_t HugePageSize = size_t(2) << 20;
+
+	void Allocate_(size_t bytes)
+	{
+		m_size = bytes;
+		if (bytes == 0) return;
+#ifdef _WIN32
+		//Large pages need SeLockMemoryPrivilege, so just take normal committed pages here.
+		m_mappedSize = bytes;
+		m_data = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (!m_data) throw std::bad_alloc{};
+#else
+		if constexpr (UseHugePages)
+		{
+			if (bytes >= HugePageSize)
+			{
+				m_mappedSize = (bytes + HugePageSize - 1) / HugePageSize * HugePageSize;
+				void* data = mmap(nullptr, m_mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+				if (data != MAP_FAILED)
+				{
+					m_data = data;
+					m_pageKind = PageKind::ExplicitHuge;
+					return;
+				}
+			}
+		}
+
+		m_mappedSize = bytes;
+		void* data = mmap(nullptr, m_mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (data == MAP_FAILED) throw std::bad_alloc{};
+		m_data = data;
+
+		if constexpr (UseHugePages)
+		{
+			if (bytes >= HugePageSize && madvise(m_data, m_mappedSize, MADV_HUGEPAGE) == 0)
+			{
+				m_pageKind = PageKind::TransparentHuge;
+			}
+		}
+#endif
+	}
+
+	void Release_()
+	{
+		if (!m_data) return;
+#ifdef _WIN32
+		VirtualFree(m_data, 0, MEM_RELEASE);
+#else
+		munmap(m_data, m_mappedSize);
+#endif
+		m_data = nullptr;
+	}
+
+	void* m_data = nullptr;
+	size_t m_size = 0;
+	size_t m_mappedSize = 0;
+	PageKind m_pageKind = PageKind::Normal;
+};
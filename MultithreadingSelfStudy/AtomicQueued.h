@@ -2,12 +2,23 @@
 #include <iostream>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <span>
-#include <format>
+#include <optional>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <array>
+#include <cstdio>
 #include "Globals.h"
 #include "Task.h"
+#include "TransitionTable.h"
 #include "Timing.h"
+#include "PerfCounters.h"
 #include "Timer.h"
+#include "ShardedIndex.h"
+#include "Topology.h"
 
 namespace AtomicQueued
 {
@@ -16,7 +27,22 @@ namespace AtomicQueued
 	public:
 		ControlObject() : m_lk{ m_mtx }
 		{
-
+			if constexpr (UseShardedIndex)
+			{
+				//Workers fill one cache group before the next, and get a shard per group they ended up in.
+				const auto topology = CpuTopology::Detect();
+				const auto order = topology.CpuOrder();
+				std::vector<size_t> groupsUsed;
+				for (size_t i = 0; i < WORKER_COUNT; i++)
+				{
+					m_workerCpus[i] = order[i % order.size()];
+					const size_t group = topology.GroupOf(m_workerCpus[i]);
+					const auto found = std::ranges::find(groupsUsed, group);
+					m_workerShards[i] = size_t(found - groupsUsed.begin());
+					if (found == groupsUsed.end()) groupsUsed.push_back(group);
+				}
+				m_shardedIndex.emplace(groupsUsed.size());
+			}
 		}
 
 		void SignalDone()
@@ -50,10 +76,24 @@ namespace AtomicQueued
 		{
 			m_index = 0;
 			m_currentChunk = chunk;
+			if constexpr (UseShardedIndex)
+			{
+				m_shardedIndex->Reset(chunk.size());
+			}
+		}
+
+		unsigned GetWorkerCpu(size_t worker) const
+		{
+			return m_workerCpus[worker];
 		}
 
-		const Task* GetTask()
+		const Task* GetTask(size_t worker)
 		{
+			if constexpr (UseShardedIndex)
+			{
+				size_t i;
+				return m_shardedIndex->Claim(m_workerShards[worker], i) ? &m_currentChunk[i] : nullptr;
+			}
 			const auto i = m_index++;
 			if (i >= CHUNK_SIZE)
 			{
@@ -70,12 +110,15 @@ namespace AtomicQueued
 		//SharedMemory 
 		int m_doneCount = 0;
 		std::atomic<size_t> m_index = 0;
+		std::optional<ShardedIndex> m_shardedIndex; //Replaces m_index with UseShardedIndex.
+		std::array<unsigned, WORKER_COUNT> m_workerCpus{};
+		std::array<size_t, WORKER_COUNT> m_workerShards{};
 	};
 
 	class Worker
 	{
 	public:
-		Worker(ControlObject* control) : m_PControl{ control }, m_thread{ &Worker::Run, this }
+		Worker(ControlObject* control, size_t index) : m_PControl{ control }, m_index{ index }, m_thread{ &Worker::Run, this }
 		{
 
 		}
@@ -114,6 +157,11 @@ namespace AtomicQueued
 			return m_heavyItemsProcessed;
 		}
 
+		PerfSample GetChunkCounters() const
+		{
+			return m_chunkCounters;
+		}
+
 		~Worker()
 		{
 			Kill();
@@ -124,9 +172,9 @@ namespace AtomicQueued
 		{
 
 			m_heavyItemsProcessed = 0;
-			while (auto pTask = m_PControl->GetTask()) //As long as there are still tasks, it will keep running. 
+			while (auto pTask = m_PControl->GetTask(m_index)) //As long as there are still tasks, it will keep running. 
 			{
-				m_accumulate += pTask->Process();
+				m_accumulate += ProcessTask(*pTask);
 				if constexpr (ChunkMeasurementEnabled)
 				{
 					m_heavyItemsProcessed += pTask->heavy ? 1 : 0;
@@ -137,8 +185,18 @@ namespace AtomicQueued
 		//Run is the while loop happening on the thread. The other functions here are interface functions abstracted, and happen from the main thread. 
 		void Run()
 		{
+			if constexpr (UseShardedIndex)
+			{
+				PinCurrentThread(m_PControl->GetWorkerCpu(m_index));
+			}
 			std::unique_lock lk {m_mtx};
 			Timer localTimer;
+			std::optional<PerfCounters> counters; //Opened on this thread, so it counts this worker only.
+			PerfSample chunkStart;
+			if constexpr (ChunkMeasurementEnabled && PerfCountersEnabled)
+			{
+				counters.emplace();
+			}
 			while (true)
 			{
 				//1. Lock. 2. Extra condition. 
@@ -148,12 +206,20 @@ namespace AtomicQueued
 				if constexpr (ChunkMeasurementEnabled)
 				{
 					localTimer.StartTimer();
+					if constexpr (PerfCountersEnabled)
+					{
+						chunkStart = counters->Read();
+					}
 				}
 				ProcessData_(); //Mutex remains locked when processing this. 
 
 				if constexpr (ChunkMeasurementEnabled)
 				{
 					m_workTime = localTimer.GetTime();
+					if constexpr (PerfCountersEnabled)
+					{
+						m_chunkCounters = counters->Read() - chunkStart;
+					}
 				}
 
 				m_working = false;
@@ -162,7 +228,7 @@ namespace AtomicQueued
 		}
 
 		ControlObject* m_PControl;
-		std::jthread m_thread;
+		size_t m_index;
 		std::condition_variable m_cv;
 		std::mutex m_mtx;
 
@@ -171,10 +237,14 @@ namespace AtomicQueued
 		bool m_threadDying = false;
 		float m_workTime = -1.f;
 		size_t m_heavyItemsProcessed = 0;
+		PerfSample m_chunkCounters;
 		bool m_working = false;
+		std::jthread m_thread; //Declared last, so everything Run touches is constructed before the thread starts. 
 	};
 
-	int DoExperiment(std::vector<std::array<Task, CHUNK_SIZE>> chunks)
+	//Chunks can be any range of chunks, a span over a Dataset or a ChunkStream reading from disk.
+	template<typename ChunkRange>
+	int DoExperiment(ChunkRange&& chunks)
 	{
 		std::vector<ChunkTimingInfo> timings;
 		timings.reserve(CHUNK_COUNT);
@@ -185,7 +255,10 @@ namespace AtomicQueued
 		ControlObject mControl;
 		std::vector<std::unique_ptr<Worker>> workerPtrs(WORKER_COUNT);
 
-		std::ranges::generate(workerPtrs, [m_PControl = &mControl] {return std::make_unique<Worker>(m_PControl); });
+		for (size_t i = 0; i < WORKER_COUNT; i++)
+		{
+			workerPtrs[i] = std::make_unique<Worker>(&mControl, i);
+		}
 
 		Timer chunkTimer;
 
@@ -211,6 +284,7 @@ namespace AtomicQueued
 				{
 					timings.back().numberOfHeavyItemsPerThread[i] = workerPtrs[i]->GetNumHeavyItemsProcessed();
 					timings.back().timeSpentWorkingPerThread[i] = workerPtrs[i]->GetJobWorkTime();
+					timings.back().countersPerThread[i] = workerPtrs[i]->GetChunkCounters();
 					timings.back().totalChunkTime = chunkTime;
 				}
 			}
@@ -0,0 +1,348 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Globals.h"
+#include "Task.h"
+#include "Timer.h"
+#include "AtomicQueued.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//On-disk chunk format for datasets that don't fit in memory.
+//A one page header, then every chunk as a page aligned block in SoA layout: CHUNK_SIZE vals, then CHUNK_SIZE 32 bit iteration counts.
+//Version 1 had a heavy byte per task instead, from before tasks carried their own iteration count.
+//Page aligned blocks mean a chunk can be prefetched or dropped from the mapping on its own.
+struct ChunkFileHeader
+{
+	static constexpr std::array<char, 8> ExpectedMagic = { 'T', 'K', 'C', 'H', 'U', 'N', 'K', 'S' };
+	static constexpr uint32_t CurrentVersion = 2;
+	static constexpr uint64_t PageSize = 4096;
+
+	std::array<char, 8> magic = ExpectedMagic;
+	uint32_t version = CurrentVersion;
+	uint32_t headerSize = uint32_t(PageSize);
+	uint64_t chunkSize = CHUNK_SIZE;
+	uint64_t chunkCount = 0;
+	uint64_t chunkStride = 0;
+
+	static constexpr uint64_t StrideFor(uint64_t chunkSize)
+	{
+		const uint64_t bytes = chunkSize * (sizeof(double) + sizeof(uint32_t));
+		return (bytes + PageSize - 1) / PageSize * PageSize;
+	}
+};
+
+//Generates the file chunk by chunk with one of the FillChunk* functions, so it never needs the whole dataset in memory.
+template<typename F>
+void WriteChunkFile(const std::string& path, size_t chunkCount, F&& fill)
+{
+	std::ofstream file{ path, std::ios_base::binary | std::ios_base::trunc };
+	if (!file) throw std::runtime_error{ "Can't open chunk file for writing: " + path };
+
+	ChunkFileHeader header;
+	header.chunkCount = chunkCount;
+	header.chunkStride = ChunkFileHeader::StrideFor(CHUNK_SIZE);
+
+	std::vector<char> page(ChunkFileHeader::PageSize, 0);
+	std::memcpy(page.data(), &header, sizeof(header));
+	file.write(page.data(), page.size());
+
+	Chunk chunk;
+	std::vector<char> block(header.chunkStride, 0);
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		fill(chunk, i);
+		auto* vals = reinterpret_cast<double*>(block.data());
+		auto* iterations = reinterpret_cast<uint32_t*>(block.data() + CHUNK_SIZE * sizeof(double));
+		for (size_t t = 0; t < CHUNK_SIZE; t++)
+		{
+			vals[t] = chunk[t].val;
+			iterations[t] = chunk[t].iterations;
+		}
+		file.write(block.data(), block.size());
+	}
+	if (!file) throw std::runtime_error{ "Failed writing chunk file: " + path };
+}
+
+//Read only mapping of a chunk file, with the kernel told we read it front to back.
+class MappedChunkFile
+{
+public:
+	explicit MappedChunkFile(const std::string& path)
+	{
+#ifdef _WIN32
+		m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE) throw std::runtime_error{ "Can't open chunk file: " + path };
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size))
+		{
+			Release_();
+			throw std::runtime_error{ "Can't size up chunk file: " + path };
+		}
+		m_size = size_t(size.QuadPart);
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		m_data = m_mapping ? static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+		if (!m_data)
+		{
+			Release_();
+			throw std::runtime_error{ "Can't map chunk file: " + path };
+		}
+#else
+		m_fd = open(path.c_str(), O_RDONLY);
+		if (m_fd < 0) throw std::runtime_error{ "Can't open chunk file: " + path };
+		struct stat info;
+		if (fstat(m_fd, &info) != 0)
+		{
+			Release_();
+			throw std::runtime_error{ "Can't size up chunk file: " + path };
+		}
+		m_size = size_t(info.st_size);
+		void* data = m_size ? mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0) : MAP_FAILED;
+		if (data == MAP_FAILED)
+		{
+			Release_();
+			throw std::runtime_error{ "Can't map chunk file: " + path };
+		}
+		m_data = static_cast<const char*>(data);
+		madvise(data, m_size, MADV_SEQUENTIAL); //Aggressive readahead, and pages behind us can go first.
+		posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+		if (m_size < sizeof(ChunkFileHeader))
+		{
+			Release_();
+			throw std::runtime_error{ "Chunk file too small: " + path };
+		}
+		std::memcpy(&m_header, m_data, sizeof(m_header));
+		//Everything Block_ adds up comes from the file, so it's all checked against the mapping first. The chunk count is bounded
+		//by division, a huge one from a corrupt file would wrap the multiplication around and pass.
+		if (m_header.magic != ChunkFileHeader::ExpectedMagic || m_header.version != ChunkFileHeader::CurrentVersion
+			|| m_header.chunkSize != CHUNK_SIZE || m_header.chunkStride != ChunkFileHeader::StrideFor(CHUNK_SIZE)
+			|| m_header.headerSize != ChunkFileHeader::PageSize || m_size < m_header.headerSize
+			|| m_header.chunkCount > (m_size - m_header.headerSize) / m_header.chunkStride)
+		{
+			Release_();
+			throw std::runtime_error{ "Not a chunk file for this CHUNK_SIZE: " + path };
+		}
+	}
+	MappedChunkFile(const MappedChunkFile&) = delete;
+	MappedChunkFile& operator=(const MappedChunkFile&) = delete;
+	~MappedChunkFile()
+	{
+		Release_();
+	}
+
+	size_t ChunkCount() const
+	{
+		return size_t(m_header.chunkCount);
+	}
+
+	size_t SizeInBytes() const
+	{
+		return m_size;
+	}
+
+	std::span<const double> Vals(size_t chunk) const
+	{
+		return { reinterpret_cast<const double*>(Block_(chunk)), CHUNK_SIZE };
+	}
+
+	std::span<const uint32_t> Iterations(size_t chunk) const
+	{
+		return { reinterpret_cast<const uint32_t*>(Block_(chunk) + CHUNK_SIZE * sizeof(double)), CHUNK_SIZE };
+	}
+
+	//Starts reading a chunk in the background, so it's in the page cache by the time we get to it.
+	void Prefetch(size_t chunk) const
+	{
+		if (chunk >= ChunkCount()) return;
+#ifdef _WIN32
+		WIN32_MEMORY_RANGE_ENTRY range{ const_cast<char*>(Block_(chunk)), size_t(m_header.chunkStride) };
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+		madvise(const_cast<char*>(Block_(chunk)), m_header.chunkStride, MADV_WILLNEED);
+#endif
+	}
+
+	//Drops a chunk we're done with from our mapping, so streaming a huge file doesn't grow the resident set.
+	void Evict(size_t chunk) const
+	{
+		if (chunk >= ChunkCount()) return;
+#ifndef _WIN32
+		madvise(const_cast<char*>(Block_(chunk)), m_header.chunkStride, MADV_DONTNEED);
+#endif
+	}
+
+	//Throws the file out of the OS page cache, so the next pass really reads from disk.
+	void DropPageCache() const
+	{
+#ifndef _WIN32
+		for (size_t i = 0; i < ChunkCount(); i++)
+		{
+			Evict(i);
+		}
+		fdatasync(m_fd); //Dirty pages from just writing the file can't be dropped.
+		posix_fadvise(m_fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+	}
+
+private:
+	const char* Block_(size_t chunk) const
+	{
+		return m_data + m_header.headerSize + chunk * m_header.chunkStride;
+	}
+
+	void Release_()
+	{
+#ifdef _WIN32
+		if (m_data) UnmapViewOfFile(m_data);
+		if (m_mapping) CloseHandle(m_mapping);
+		if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+		m_mapping = nullptr;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_data) munmap(const_cast<char*>(m_data), m_size);
+		if (m_fd >= 0) close(m_fd);
+		m_fd = -1;
+#endif
+		m_data = nullptr;
+	}
+
+#ifdef _WIN32
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = nullptr;
+#else
+	int m_fd = -1;
+#endif
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+	ChunkFileHeader m_header;
+};
+
+//A range of chunks streamed out of a MappedChunkFile, usable anywhere the engines take a span of chunks.
+//Dereferencing unpacks chunk k into a staging chunk and asks the OS for chunk k+2, so disk reads overlap with processing k.
+class ChunkStream
+{
+public:
+	static constexpr size_t PrefetchDistance = 2;
+
+	explicit ChunkStream(const MappedChunkFile& file) : m_PFile{ &file }
+	{}
+
+	class Iterator
+	{
+	public:
+		using difference_type = std::ptrdiff_t;
+		using value_type = std::span<const Task>;
+
+		Iterator() = default;
+		Iterator(ChunkStream* stream, size_t index) : m_PStream{ stream }, m_index{ index }
+		{}
+
+		std::span<const Task> operator*() const
+		{
+			return m_PStream->Stage_(m_index);
+		}
+		Iterator& operator++()
+		{
+			m_index++;
+			return *this;
+		}
+		void operator++(int)
+		{
+			++*this;
+		}
+		bool operator==(const Iterator& rhs) const
+		{
+			return m_index == rhs.m_index;
+		}
+
+	private:
+		ChunkStream* m_PStream = nullptr;
+		size_t m_index = 0;
+	};
+
+	Iterator begin()
+	{
+		for (size_t i = 0; i < PrefetchDistance; i++)
+		{
+			m_PFile->Prefetch(i);
+		}
+		return { this, 0 };
+	}
+
+	Iterator end()
+	{
+		return { this, m_PFile->ChunkCount() };
+	}
+
+private:
+	//The engines finish a chunk before they move on, so one staging chunk is enough.
+	std::span<const Task> Stage_(size_t index)
+	{
+		if (index != m_stagedIndex)
+		{
+			m_PFile->Prefetch(index + PrefetchDistance);
+			const auto vals = m_PFile->Vals(index);
+			const auto iterations = m_PFile->Iterations(index);
+			for (size_t t = 0; t < CHUNK_SIZE; t++)
+			{
+				m_staging[t] = Task::Make(vals[t], iterations[t]);
+			}
+			if (index > 0)
+			{
+				m_PFile->Evict(index - 1);
+			}
+			m_stagedIndex = index;
+		}
+		return m_staging;
+	}
+
+	const MappedChunkFile* m_PFile;
+	Chunk m_staging;
+	size_t m_stagedIndex = size_t(-1);
+};
+
+//Streams a random dataset from disk with a cold page cache, once just reading it and once through the AtomicQueued engine.
+int DoChunkFileBenchmark()
+{
+	const std::string path = "chunks.bin";
+	WriteChunkFile(path, CHUNK_COUNT, FillChunkRandom);
+	const MappedChunkFile file{ path };
+	const double gigabytes = double(file.SizeInBytes()) / 1e9;
+	const double tasks = double(file.ChunkCount() * CHUNK_SIZE);
+
+	file.DropPageCache();
+	Timer timer;
+	timer.StartTimer();
+	size_t heavyCount = 0;
+	for (const auto chunk : ChunkStream{ file })
+	{
+		heavyCount += std::ranges::count_if(chunk, &Task::heavy);
+	}
+	const double scanSeconds = timer.GetTime() / 1e6;
+	printf("Cold scan: %f seconds, %f tasks/sec, %f GB/s (%zu heavy) \n", scanSeconds, tasks / scanSeconds, gigabytes / scanSeconds, heavyCount);
+
+	file.DropPageCache();
+	timer.StartTimer();
+	AtomicQueued::DoExperiment(ChunkStream{ file });
+	const double runSeconds = timer.GetTime() / 1e6;
+	printf("Cold experiment: %f seconds, %f tasks/sec, %f GB/s \n", runSeconds, tasks / runSeconds, gigabytes / runSeconds);
+	return 0;
+}
@@ -0,0 +1,245 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include "Globals.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+//ThreadSanitizer has to be told about every stack switch, otherwise it sees one thread doing impossible things.
+#if defined(__SANITIZE_THREAD__)
+#define TK_FIBER_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define TK_FIBER_TSAN 1
+#endif
+#endif
+#ifdef TK_FIBER_TSAN
+#include <sanitizer/tsan_interface.h>
+#endif
+
+namespace tk
+{
+	//A stack and a saved set of registers, so whatever runs on it can stop halfway and let the thread do something else. Resume switches in from
+	//the thread running it, Suspend switches from inside back to wherever Resume was called. entry runs once on the fiber's own stack and never returns,
+	//it suspends for good instead, so a fiber can loop over many pieces of work. The stack has a guard page under it, an overflow crashes instead of
+	//quietly writing over the next one.
+	class Fiber
+	{
+	public:
+		using Entry = void (*)(Fiber&);
+
+		explicit Fiber(Entry entry) : m_entry{ entry }
+		{
+#ifdef _WIN32
+			m_handle = CreateFiber(FiberStackSize, &Start_, this);
+			if (!m_handle) throw std::bad_alloc{};
+#else
+			m_guardSize = size_t(sysconf(_SC_PAGESIZE));
+			m_mappedSize = m_guardSize + FiberStackSize;
+			m_stack = mmap(nullptr, m_mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+			if (m_stack == MAP_FAILED) throw std::bad_alloc{};
+			if (mprotect(m_stack, m_guardSize, PROT_NONE) != 0) //Stacks grow down, so the guard goes at the bottom.
+			{
+				munmap(m_stack, m_mappedSize); //No destructor runs for a constructor that throws.
+				throw std::bad_alloc{};
+			}
+			getcontext(&m_context);
+			m_context.uc_stack.ss_sp = static_cast<std::byte*>(m_stack) + m_guardSize;
+			m_context.uc_stack.ss_size = FiberStackSize;
+			m_context.uc_link = nullptr;
+			//makecontext only passes ints, so this goes over in two halves.
+			const auto self = uint64_t(uintptr_t(this));
+			makecontext(&m_context, reinterpret_cast<void (*)()>(&Start_), 2, unsigned(self >> 32), unsigned(self & 0xFFFFFFFF));
+#endif
+#ifdef TK_FIBER_TSAN
+			m_tsanFiber = __tsan_create_fiber(0);
+#endif
+		}
+
+		Fiber(const Fiber&) = delete;
+		Fiber& operator=(const Fiber&) = delete;
+
+		//Whatever is still on the stack is dropped without being unwound, so only destroy a fiber that is parked between pieces of work.
+		~Fiber()
+		{
+#ifdef TK_FIBER_TSAN
+			__tsan_destroy_fiber(m_tsanFiber);
+#endif
+#ifdef _WIN32
+			DeleteFiber(m_handle);
+#else
+			munmap(m_stack, m_mappedSize);
+#endif
+		}
+
+		//Runs the fiber until it suspends. On Windows the calling thread has to be a fiber itself, see FiberHost.
+		void Resume()
+		{
+#ifdef TK_FIBER_TSAN
+			m_tsanCaller = __tsan_get_current_fiber();
+			__tsan_switch_to_fiber(m_tsanFiber, 0);
+#endif
+#ifdef _WIN32
+			m_caller = GetCurrentFiber();
+			SwitchToFiber(m_handle);
+#else
+			swapcontext(&m_caller, &m_context); //Saves and restores the signal mask too, that syscall is most of what a switch costs.
+#endif
+		}
+
+		//Only from inside the fiber. Comes back when it's resumed again.
+		void Suspend()
+		{
+#ifdef TK_FIBER_TSAN
+			__tsan_switch_to_fiber(m_tsanCaller, 0);
+#endif
+#ifdef _WIN32
+			SwitchToFiber(m_caller);
+#else
+			swapcontext(&m_context, &m_caller);
+#endif
+		}
+
+	private:
+#ifdef _WIN32
+		static void WINAPI Start_(void* self)
+		{
+			auto& fiber = *static_cast<Fiber*>(self);
+			fiber.m_entry(fiber);
+		}
+
+		void* m_handle = nullptr;
+		void* m_caller = nullptr;
+#else
+		static void Start_(unsigned high, unsigned low)
+		{
+			auto& fiber = *reinterpret_cast<Fiber*>(uintptr_t(uint64_t(high) << 32 | low));
+			fiber.m_entry(fiber);
+		}
+
+		void* m_stack = nullptr;
+		size_t m_guardSize = 0;
+		size_t m_mappedSize = 0;
+		ucontext_t m_context{};
+		ucontext_t m_caller{};
+#endif
+#ifdef TK_FIBER_TSAN
+		void* m_tsanFiber = nullptr;
+		void* m_tsanCaller = nullptr;
+#endif
+		Entry m_entry;
+	};
+
+	//Windows can only switch between fibers, so a thread that resumes them has to be turned into one while it does. Nothing to do elsewhere.
+	class FiberHost
+	{
+	public:
+		FiberHost()
+		{
+#ifdef _WIN32
+			m_converted = !IsThreadAFiber() && ConvertThreadToFiber(nullptr);
+#endif
+		}
+
+		FiberHost(const FiberHost&) = delete;
+		FiberHost& operator=(const FiberHost&) = delete;
+
+		~FiberHost()
+		{
+#ifdef _WIN32
+			if (m_converted) ConvertFiberToThread();
+#endif
+		}
+
+	private:
+		bool m_converted = false;
+	};
+
+	class FiberScheduler;
+	class FiberWaitList;
+
+	//A fiber parked on a FiberWaitList. Lives on that fiber's own stack for as long as it waits.
+	struct FiberWaiter
+	{
+		FiberWaiter* next = nullptr;
+		FiberScheduler* scheduler = nullptr;
+		Fiber* fiber = nullptr;
+	};
+
+	//Runs fibers on the current thread, a fiber mode ThreadPool worker. Blocking calls that know about fibers ask Current whether they're running on one,
+	//and if so park the fiber instead of the thread, so the thread can get on with other fibers meanwhile.
+	class FiberScheduler
+	{
+	public:
+		//Null unless the calling code runs on a fiber of some scheduler.
+		static FiberScheduler* Current()
+		{
+			return t_current;
+		}
+
+		//From the running fiber. Pushes it onto the list and switches away until the list is woken, or returns straight away if it was already.
+		virtual void Park(FiberWaitList& list) = 0;
+
+		//From any thread. Puts a parked fiber back in line to run on this scheduler.
+		virtual void Resume(Fiber& fiber) = 0;
+
+	protected:
+		~FiberScheduler() = default;
+
+		static void SetCurrent_(FiberScheduler* scheduler)
+		{
+			t_current = scheduler;
+		}
+
+	private:
+		static inline thread_local FiberScheduler* t_current = nullptr;
+	};
+
+	//Fibers waiting for one thing to happen, a lock free stack that closes for good when it's woken. A fiber pushing itself after that finds it closed
+	//and doesn't park at all, so it can't miss the wake-up however the two race. One pointer, so every shared state can afford one.
+	class FiberWaitList
+	{
+	public:
+		//False when the list was already woken, then there's nothing to wait for anymore.
+		bool Push(FiberWaiter& waiter)
+		{
+			FiberWaiter* head = m_head.load(std::memory_order_acquire);
+			do
+			{
+				if (head == Closed_()) return false;
+				waiter.next = head;
+			} while (!m_head.compare_exchange_weak(head, &waiter, std::memory_order_acq_rel, std::memory_order_acquire));
+			return true;
+		}
+
+		void WakeAll()
+		{
+			FiberWaiter* waiter = m_head.exchange(Closed_(), std::memory_order_acq_rel);
+			while (waiter && waiter != Closed_())
+			{
+				FiberWaiter* next = waiter->next; //Read first, the waiter is gone as soon as its fiber runs again.
+				waiter->scheduler->Resume(*waiter->fiber);
+				waiter = next;
+			}
+		}
+
+	private:
+		static FiberWaiter* Closed_()
+		{
+			static FiberWaiter closed;
+			return &closed;
+		}
+
+		std::atomic<FiberWaiter*> m_head = nullptr;
+	};
+}
\ No newline at end of file
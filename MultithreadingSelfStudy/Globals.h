@@ -1,14 +1,38 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
 
 //Settings for now
 inline constexpr bool ChunkMeasurementEnabled = false;
+inline constexpr bool PerfCountersEnabled = false; //Per worker perf_event counters in the chunk timings and the pool, Linux only.
+inline constexpr bool PoolMetricsEnabled = false; //Default for tk::ThreadPool's live metrics: queue depth, busy workers, completions and queue wait times.
+inline constexpr bool PoolFibersEnabled = false; //Default for running tk::ThreadPool tasks on fibers, so a blocking Future::Get parks the task instead of the worker.
+inline constexpr size_t FiberStackSize = 64 * 1024; //Per fiber, plus a guard page. Only the pages a task touches get committed.
 inline constexpr size_t WORKER_COUNT = 4;
 inline constexpr size_t CHUNK_SIZE = 8000;
 inline constexpr size_t CHUNK_COUNT = 100;
 inline constexpr size_t SUBSET_SIZE = CHUNK_SIZE / WORKER_COUNT;
+inline constexpr size_t PRODUCER_COUNT = 2; //Generator threads in the pipelined mode.
+inline constexpr size_t PIPELINE_BUFFERS = 8; //Chunk buffers cycling between producers and the engine, a power of two.
 inline constexpr size_t LIGHT_ITERATIONS = 100;
 inline constexpr size_t HEAVY_ITERATIONS = 1000;
 inline constexpr double ProbabilityHeavy = .15;
+inline constexpr size_t MaxTaskIterations = 100000; //Cap for the heavy tailed workloads in Workload.h, one task can't take more than a few ms.
+inline constexpr uint64_t DatasetSeed = 0x5EED; //Same seed, same datasets, whatever the thread count.
+inline constexpr bool UseTransitionTable = false; //Engines answer Task::Process from precomputed jump tables instead of looping.
+inline constexpr bool UseHugePages = true; //Back datasets with huge pages where the OS allows it.
+inline constexpr bool UseShardedIndex = false; //AtomicQueued pins its workers per L3 group and gives every group its own work counter.
+
+//Which lock queued::ControlObject::GetTask and tk::ThreadPool's queues take, see Locks.h.
+enum class LockKind
+{
+	StdMutex,
+	Ttas, //Test and test and set spinlock with exponential backoff.
+	Ticket,
+	Mcs, //Queue lock, every waiter spins on its own cache line.
+	SpinFutex //Spins adaptively, then sleeps on a futex.
+};
+inline constexpr LockKind QueueLock = LockKind::StdMutex;
 
 static_assert(CHUNK_SIZE >= WORKER_COUNT);
 static_assert(CHUNK_SIZE% WORKER_COUNT == 0);
\ No newline at end of file
@@ -0,0 +1,433 @@
+#pragma once
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <span>
+#include <optional>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include "Globals.h"
+#include "Task.h"
+#include "TransitionTable.h"
+#include "Timing.h"
+#include "PerfCounters.h"
+#include "Timer.h"
+
+//Preassigned first, stealing once a worker runs dry. Every worker starts on its own SUBSET_SIZE range of the chunk like preassigned,
+//and a worker that finishes early takes half of what's left of the most loaded peer, from the back, so owner and thief work at opposite ends.
+namespace hybrid
+{
+	//The owner takes this many tasks off the front per claim and runs them with a private index, so it pays one CAS per grain instead of an atomic per task.
+	//Small enough that the work a thief can't get at is a few tasks.
+	inline constexpr uint32_t ClaimGrain = 16;
+
+	//[front, back) of one worker's range, packed in one word, so the owner's claims and a thief's split can't both get the same task.
+	//back is the split point, a thief moves it down and keeps everything behind it.
+	class StealableRange
+	{
+	public:
+		struct Bounds
+		{
+			uint32_t front;
+			uint32_t back;
+			uint32_t Size() const
+			{
+				return back > front ? back - front : 0;
+			}
+		};
+
+		void Reset(uint32_t front, uint32_t back)
+		{
+			m_bounds.store(Pack_({ front, back }), std::memory_order_relaxed);
+		}
+
+		uint32_t Remaining() const
+		{
+			return Unpack_(m_bounds.load(std::memory_order_relaxed)).Size();
+		}
+
+		//Owner side. Returns the claimed [front, back), empty when the range is used up.
+		Bounds ClaimFront(uint32_t grain)
+		{
+			auto packed = m_bounds.load(std::memory_order_relaxed);
+			while (true)
+			{
+				const auto bounds = Unpack_(packed);
+				if (bounds.Size() == 0) return { bounds.front, bounds.front };
+				const uint32_t end = bounds.front + std::min(grain, bounds.Size());
+				if (m_bounds.compare_exchange_weak(packed, Pack_({ end, bounds.back }), std::memory_order_acquire, std::memory_order_relaxed))
+				{
+					return { bounds.front, end };
+				}
+			}
+		}
+
+		//Thief side. Takes the back half of what's left, nothing if there's only one task or less, the owner will get to that sooner.
+		Bounds StealBack()
+		{
+			auto packed = m_bounds.load(std::memory_order_relaxed);
+			while (true)
+			{
+				const auto bounds = Unpack_(packed);
+				const uint32_t half = bounds.Size() / 2;
+				if (half == 0) return { 0, 0 };
+				const uint32_t split = bounds.back - half;
+				if (m_bounds.compare_exchange_weak(packed, Pack_({ bounds.front, split }), std::memory_order_acquire, std::memory_order_relaxed))
+				{
+					return { split, bounds.back };
+				}
+			}
+		}
+
+	private:
+		static uint64_t Pack_(Bounds bounds)
+		{
+			return uint64_t(bounds.front) << 32 | bounds.back;
+		}
+
+		static Bounds Unpack_(uint64_t packed)
+		{
+			return { uint32_t(packed >> 32), uint32_t(packed) };
+		}
+
+		std::atomic<uint64_t> m_bounds = 0;
+	};
+
+	//One StealableRange per worker, starting out as the preassigned subsets of a chunk.
+	class RangeSet
+	{
+	public:
+		void Reset()
+		{
+			for (size_t i = 0; i < WORKER_COUNT; i++)
+			{
+				m_ranges[i].range.Reset(uint32_t(i * SUBSET_SIZE), uint32_t((i + 1) * SUBSET_SIZE));
+			}
+		}
+
+		StealableRange& GetRange(size_t worker)
+		{
+			return m_ranges[worker].range;
+		}
+
+		//Half of the most loaded peer's leftovers, moved into the thief's own range so it can be stolen from again.
+		//False once nobody has more than a single task left.
+		bool Steal(size_t thief)
+		{
+			while (true)
+			{
+				size_t victim = thief;
+				uint32_t most = 1;
+				for (size_t i = 0; i < WORKER_COUNT; i++)
+				{
+					const uint32_t remaining = m_ranges[i].range.Remaining();
+					if (i != thief && remaining > most)
+					{
+						most = remaining;
+						victim = i;
+					}
+				}
+				if (victim == thief) return false;
+
+				const auto stolen = m_ranges[victim].range.StealBack();
+				if (stolen.Size() > 0)
+				{
+					m_ranges[thief].range.Reset(stolen.front, stolen.back); //Ours is empty, nobody else will touch it.
+					m_steals.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+				//Someone else got there first, look again.
+			}
+		}
+
+		size_t GetStealCount() const
+		{
+			return m_steals.load(std::memory_order_relaxed);
+		}
+
+	private:
+		struct alignas(64) PaddedRange
+		{
+			StealableRange range;
+		};
+
+		std::array<PaddedRange, WORKER_COUNT> m_ranges; //Own cache line each, thieves only ever touch the victim's.
+		alignas(64) std::atomic<size_t> m_steals = 0;
+	};
+
+	class ControlObject
+	{
+	public:
+		ControlObject() : m_lk{ m_mtx }
+		{
+
+		}
+
+		void SignalDone()
+		{
+			bool needsNotification = false;
+			{
+				std::lock_guard lk {m_mtx};
+				m_doneCount++;
+
+				//Has to happen while the mutex is still held, so there's no race condition
+				if (m_doneCount == WORKER_COUNT)
+				{
+					//Notify the condition variable of this thread.
+					needsNotification = true;
+				}
+			}
+			if (needsNotification)
+			{
+				m_cv.notify_one();
+			}
+		}
+
+		void WaitForAllDone()
+		{
+			//Wait until work is done.
+			m_cv.wait(m_lk, [this] {return m_doneCount == WORKER_COUNT; });
+			m_doneCount = 0;
+		}
+
+		//Happens before the workers are started, so their mutex hands the new ranges over.
+		void SetChunk(std::span<const Task> chunk)
+		{
+			m_currentChunk = chunk;
+			m_ranges.Reset();
+		}
+
+		const Task& GetTask(uint32_t index) const
+		{
+			return m_currentChunk[index];
+		}
+
+		StealableRange& GetRange(size_t worker)
+		{
+			return m_ranges.GetRange(worker);
+		}
+
+		bool Steal(size_t thief)
+		{
+			return m_ranges.Steal(thief);
+		}
+
+		size_t GetStealCount() const
+		{
+			return m_ranges.GetStealCount();
+		}
+
+	private:
+		std::condition_variable m_cv;
+		std::mutex m_mtx;
+		std::unique_lock<std::mutex> m_lk;
+		std::span<const Task> m_currentChunk; //Basically a flexible array.
+		//SharedMemory
+		int m_doneCount = 0;
+		RangeSet m_ranges;
+	};
+
+	class Worker
+	{
+	public:
+		Worker(ControlObject* control, size_t index) : m_PControl{ control }, m_index{ index }, m_thread{ &Worker::Run, this }
+		{
+
+		}
+
+		void StartWork()
+		{
+			{
+				std::lock_guard lk {m_mtx};
+				m_working = true;
+			}
+			m_cv.notify_one();
+		}
+
+		void Kill()
+		{
+			{
+				std::lock_guard lk {m_mtx};
+				m_threadDying = true;
+			}
+
+			m_cv.notify_one();
+		}
+
+		float GetJobWorkTime() const
+		{
+			return m_workTime;
+		}
+
+		double GetResult() const
+		{
+			return m_accumulate;
+		}
+
+		size_t GetNumHeavyItemsProcessed() const
+		{
+			return m_heavyItemsProcessed;
+		}
+
+		PerfSample GetChunkCounters() const
+		{
+			return m_chunkCounters;
+		}
+
+		~Worker()
+		{
+			Kill();
+		}
+
+	private:
+		void ProcessData_()
+		{
+			m_heavyItemsProcessed = 0;
+			auto& range = m_PControl->GetRange(m_index);
+			do
+			{
+				for (auto claim = range.ClaimFront(ClaimGrain); claim.Size() > 0; claim = range.ClaimFront(ClaimGrain))
+				{
+					for (uint32_t i = claim.front; i < claim.back; i++)
+					{
+						const auto& task = m_PControl->GetTask(i);
+						m_accumulate += ProcessTask(task);
+						if constexpr (ChunkMeasurementEnabled)
+						{
+							m_heavyItemsProcessed += task.heavy ? 1 : 0;
+						}
+					}
+				}
+			} while (m_PControl->Steal(m_index));
+		}
+
+		//Run is the while loop happening on the thread. The other functions here are interface functions abstracted, and happen from the main thread.
+		void Run()
+		{
+			std::unique_lock lk {m_mtx};
+			Timer localTimer;
+			std::optional<PerfCounters> counters; //Opened on this thread, so it counts this worker only.
+			PerfSample chunkStart;
+			if constexpr (ChunkMeasurementEnabled && PerfCountersEnabled)
+			{
+				counters.emplace();
+			}
+			while (true)
+			{
+				//1. Lock. 2. Extra condition.
+				m_cv.wait(lk, [this] {return m_working || m_threadDying; }); //If working or dying, wake up.
+				if (m_threadDying) break;
+
+				if constexpr (ChunkMeasurementEnabled)
+				{
+					localTimer.StartTimer();
+					if constexpr (PerfCountersEnabled)
+					{
+						chunkStart = counters->Read();
+					}
+				}
+				ProcessData_(); //Mutex remains locked when processing this.
+
+				if constexpr (ChunkMeasurementEnabled)
+				{
+					m_workTime = localTimer.GetTime();
+					if constexpr (PerfCountersEnabled)
+					{
+						m_chunkCounters = counters->Read() - chunkStart;
+					}
+				}
+
+				m_working = false;
+				m_PControl->SignalDone();
+			}
+		}
+
+		ControlObject* m_PControl;
+		size_t m_index;
+		std::condition_variable m_cv;
+		std::mutex m_mtx;
+
+		//Shared memory.
+		unsigned int m_accumulate = 0;
+		bool m_threadDying = false;
+		float m_workTime = -1.f;
+		size_t m_heavyItemsProcessed = 0;
+		PerfSample m_chunkCounters;
+		bool m_working = false;
+		std::jthread m_thread; //Declared last, so everything Run touches is constructed before the thread starts.
+	};
+
+	//Chunks can be any range of chunks, a span over a Dataset or a ChunkStream reading from disk.
+	template<typename ChunkRange>
+	int DoExperiment(ChunkRange&& chunks)
+	{
+		std::vector<ChunkTimingInfo> timings;
+		timings.reserve(CHUNK_COUNT);
+
+		Timer timer;
+		timer.StartTimer();
+
+		ControlObject mControl;
+		std::vector<std::unique_ptr<Worker>> workerPtrs(WORKER_COUNT);
+
+		for (size_t i = 0; i < WORKER_COUNT; i++)
+		{
+			workerPtrs[i] = std::make_unique<Worker>(&mControl, i);
+		}
+
+		Timer chunkTimer;
+
+		for (const auto& chunk : chunks)
+		{
+			if constexpr (ChunkMeasurementEnabled)
+			{
+				chunkTimer.StartTimer();
+			}
+
+			mControl.SetChunk(chunk);
+			for (auto& pWorker : workerPtrs)
+			{
+				pWorker->StartWork();
+			}
+
+			mControl.WaitForAllDone(); //This guy will wake up when all jobs are done.
+			if constexpr (ChunkMeasurementEnabled)
+			{
+				const auto chunkTime = chunkTimer.GetTime();
+				timings.push_back({});
+				for (size_t i = 0; i < WORKER_COUNT; i++)
+				{
+					timings.back().numberOfHeavyItemsPerThread[i] = workerPtrs[i]->GetNumHeavyItemsProcessed();
+					timings.back().timeSpentWorkingPerThread[i] = workerPtrs[i]->GetJobWorkTime();
+					timings.back().countersPerThread[i] = workerPtrs[i]->GetChunkCounters();
+					timings.back().totalChunkTime = chunkTime;
+				}
+			}
+		}
+
+		float timeElapsed = timer.GetTime();
+		printf("%f microseconds \n", timeElapsed);
+		printf("%zu steals \n", mControl.GetStealCount());
+		unsigned int answer = 0.;
+		for (const auto& w : workerPtrs)
+		{
+			answer += w->GetResult();
+		}
+		std::cout << "Result is " << answer << std::endl;
+
+		//Output csv of chunk timings.
+		// worktime, idletime, numberofheavies x workers + total time, total heavies
+		if constexpr (ChunkMeasurementEnabled)
+		{
+			WriteCSV(timings);
+		}
+
+		return 0;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,238 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <latch>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+#include "Globals.h"
+#include "Task.h"
+#include "ThreadPool.h"
+#include "TransitionTable.h"
+#include "Workload.h"
+
+//Open loop load for a ThreadPool. Tasks arrive on a schedule fixed before the run, whether the pool keeps up or not, the way requests from
+//independent clients do. Submitting everything and waiting for all of it measures throughput, but never lets a queue build up in front of the pool,
+//and the queue is where the latency goes once the load gets close to what the pool can do.
+namespace tk
+{
+	enum class Arrivals
+	{
+		Constant,
+		Poisson //Exponential gaps, so bursts and lulls at the same average rate.
+	};
+
+	//When one task was due, was handed to the pool, started and finished. Nanoseconds from the start of the run.
+	struct LoadSample
+	{
+		int64_t intended = 0;
+		int64_t sent = 0;
+		int64_t started = 0;
+		int64_t completed = 0;
+	};
+
+	//Microseconds.
+	struct LatencyPercentiles
+	{
+		double p50 = 0.;
+		double p99 = 0.;
+		double p999 = 0.;
+		double max = 0.;
+	};
+
+	inline LatencyPercentiles PercentilesOf(std::vector<double> latencies)
+	{
+		if (latencies.empty()) return {};
+		std::ranges::sort(latencies);
+		const auto at = [&](double p) { return latencies[std::min(latencies.size() - 1, size_t(p * double(latencies.size())))]; };
+		return { at(.5), at(.99), at(.999), latencies.back() };
+	}
+
+	//One offered load of a sweep.
+	struct LoadPoint
+	{
+		double offeredRate = 0.; //Tasks per second.
+		double achievedRate = 0.; //Completions per second, from the start of the run until the last one finished.
+		size_t tasks = 0;
+		LatencyPercentiles start; //Due to started, the queue wait plus however late the generator got the task out.
+		LatencyPercentiles complete; //Due to finished.
+		LatencyPercentiles uncorrectedComplete; //Submitted to finished, what a generator that ignores its own lateness would report.
+		unsigned int sum = 0;
+	};
+
+	//Arrival times in nanoseconds from the start, for the given average rate. Same seed, same schedule.
+	inline std::vector<int64_t> ArrivalSchedule(double rate, std::chrono::nanoseconds duration, Arrivals arrivals, uint64_t seed)
+	{
+		ChunkRandom random{ size_t(seed) };
+		const double meanGap = 1e9 / rate;
+		std::vector<int64_t> schedule;
+		schedule.reserve(size_t(rate * std::chrono::duration<double>(duration).count() * 1.1) + 16);
+		for (double time = 0.;;)
+		{
+			time += arrivals == Arrivals::Poisson ? -std::log(1. - random.NextUnit()) * meanGap : meanGap; //Inverse transform of the exponential.
+			if (time >= double(duration.count())) break;
+			schedule.push_back(int64_t(time));
+		}
+		return schedule;
+	}
+
+	//Offers the pool work at the given rate for the given time, then waits for the backlog to drain. Task i of the run processes work[i % size].
+	//The generator runs on the calling thread and submits every task at its due time. When it falls behind, because the pool's lock, a page fault
+	//or the OS held it up, it sends the late ones straight away in a burst. Timing those from when they actually went out would leave out exactly
+	//the wait a real client would have had (coordinated omission), so the start and complete latencies count from when the task was due.
+	inline LoadPoint RunOpenLoop(ThreadPool& pool, std::span<const ::Task> work, double rate, std::chrono::nanoseconds duration, Arrivals arrivals,
+		uint64_t seed = 0)
+	{
+		using Clock = std::chrono::steady_clock;
+		const auto schedule = ArrivalSchedule(rate, duration, arrivals, seed);
+
+		//Everything a task needs behind one pointer, so with its index the callable stays small enough for std::function not to allocate.
+		struct Run
+		{
+			Run(std::span<const ::Task> work, size_t tasks) : start{ Clock::now() }, work{ work }, samples(tasks), done{ ptrdiff_t(tasks) }
+			{}
+
+			Clock::time_point start;
+			std::span<const ::Task> work;
+			std::vector<LoadSample> samples;
+			std::latch done;
+			std::atomic<unsigned int> sum = 0;
+
+			int64_t Now() const
+			{
+				return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+			}
+		};
+		const auto run = std::make_unique<Run>(work, schedule.size());
+
+		constexpr auto yieldWindow = std::chrono::microseconds(100); //A sleep can overshoot by tens of microseconds, so the last stretch yields.
+		for (size_t i = 0; i < schedule.size(); i++)
+		{
+			const auto due = run->start + std::chrono::nanoseconds(schedule[i]);
+			if (due - Clock::now() > yieldWindow)
+			{
+				std::this_thread::sleep_until(due - yieldWindow);
+			}
+			while (Clock::now() < due)
+			{
+				std::this_thread::yield();
+			}
+
+			auto& sample = run->samples[i];
+			sample.intended = schedule[i];
+			sample.sent = run->Now();
+			pool.Post([r = run.get(), i] {
+				auto& sample = r->samples[i];
+				sample.started = r->Now();
+				const unsigned int result = ProcessTask(r->work[i % r->work.size()]);
+				sample.completed = r->Now();
+				r->sum.fetch_add(result, std::memory_order_relaxed);
+				r->done.count_down();
+				});
+		}
+		run->done.wait();
+
+		LoadPoint point;
+		point.offeredRate = rate;
+		point.tasks = schedule.size();
+		point.sum = run->sum.load(std::memory_order_relaxed);
+		std::vector<double> start;
+		std::vector<double> complete;
+		std::vector<double> uncorrected;
+		start.reserve(point.tasks);
+		complete.reserve(point.tasks);
+		uncorrected.reserve(point.tasks);
+		int64_t lastCompleted = 0;
+		for (const auto& sample : run->samples)
+		{
+			start.push_back(double(sample.started - sample.intended) * 1e-3);
+			complete.push_back(double(sample.completed - sample.intended) * 1e-3);
+			uncorrected.push_back(double(sample.completed - sample.sent) * 1e-3);
+			lastCompleted = std::max(lastCompleted, sample.completed);
+		}
+		point.achievedRate = lastCompleted > 0 ? double(point.tasks) / (double(lastCompleted) * 1e-9) : 0.;
+		point.start = PercentilesOf(std::move(start));
+		point.complete = PercentilesOf(std::move(complete));
+		point.uncorrectedComplete = PercentilesOf(std::move(uncorrected));
+		return point;
+	}
+
+	//Closed loop, everything submitted at once. What the pool can do at most, the sweep offers fractions of it.
+	inline double MeasureCapacity(ThreadPool& pool, std::span<const ::Task> work, size_t tasks)
+	{
+		std::latch done{ ptrdiff_t(tasks) };
+		std::atomic<unsigned int> sum = 0;
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < tasks; i++)
+		{
+			pool.Post([&done, &sum, &task = work[i % work.size()]] {
+				sum.fetch_add(ProcessTask(task), std::memory_order_relaxed);
+				done.count_down();
+				});
+		}
+		done.wait();
+		return double(tasks) / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	//Sweeps offered load from a tenth of the pool's capacity up to where it saturates, one second per step, and prints throughput against
+	//p50/p99/p99.9 latency, also to load.csv. Tasks come from one chunk of the two class random dataset, or of a Workload.h shape.
+	//What to read off for sizing a pool: the highest load whose p99.9 is still within budget, usually well short of the capacity.
+	inline int DoLoadBenchmark(Arrivals arrivals, std::optional<workload::Shape> shape)
+	{
+		constexpr auto stepDuration = std::chrono::seconds(1);
+		constexpr double fractions[] = { .1, .25, .5, .6, .7, .8, .85, .9, .95, 1., 1.1, 1.25, 1.5 };
+		constexpr double saturated = .95; //Achieved below this share of offered, the queue only grows.
+
+		if constexpr (UseTransitionTable)
+		{
+			TransitionTable::Instance(); //Built before anything is timed.
+		}
+
+		const auto chunk = std::make_unique<Chunk>();
+		if (shape)
+		{
+			workload::FillChunk({ .shape = *shape }, *chunk, 0);
+		}
+		else
+		{
+			FillChunkRandom(*chunk, 0);
+		}
+
+		ThreadPool pool(WORKER_COUNT);
+		MeasureCapacity(pool, *chunk, CHUNK_SIZE); //Warm up.
+		const double capacity = MeasureCapacity(pool, *chunk, CHUNK_SIZE * 4);
+		const char* arrivalName = arrivals == Arrivals::Poisson ? "poisson" : "constant";
+		printf("%s arrivals, %zu workers, capacity %f tasks/sec \n", arrivalName, WORKER_COUNT, capacity);
+
+		std::ofstream csv{ "load.csv", std::ios_base::trunc };
+		csv.precision(std::numeric_limits<double>::max_digits10);
+		csv << "arrivals;offered;achieved;tasks;start_p50;start_p99;start_p999;start_max;done_p50;done_p99;done_p999;done_max;"
+			"uncorrected_done_p50;uncorrected_done_p99;uncorrected_done_p999;uncorrected_done_max\n";
+		for (size_t step = 0; step < std::size(fractions); step++)
+		{
+			const LoadPoint point = RunOpenLoop(pool, *chunk, capacity * fractions[step], stepDuration, arrivals, step);
+			printf("%3.0f%%: offered %f, achieved %f tasks/sec, start p50 %f p99 %f p99.9 %f, done p50 %f p99 %f p99.9 %f microseconds, "
+				"uncorrected done p99.9 %f (%u) \n",
+				fractions[step] * 100., point.offeredRate, point.achievedRate, point.start.p50, point.start.p99, point.start.p999,
+				point.complete.p50, point.complete.p99, point.complete.p999, point.uncorrectedComplete.p999, point.sum);
+
+			csv << arrivalName << ';' << point.offeredRate << ';' << point.achievedRate << ';' << point.tasks;
+			for (const auto& latency : { point.start, point.complete, point.uncorrectedComplete })
+			{
+				csv << ';' << latency.p50 << ';' << latency.p99 << ';' << latency.p999 << ';' << latency.max;
+			}
+			csv << '\n';
+
+			if (point.achievedRate < point.offeredRate * saturated) break;
+		}
+		return 0;
+	}
+}
\ No newline at end of file
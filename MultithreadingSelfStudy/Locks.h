@@ -0,0 +1,350 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include "Globals.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+//Locks to swap in for std::mutex wherever code takes the lock type as a template parameter, queued::ControlObject and tk::BasicThreadPool.
+//They all have the lowercase lock/try_lock/unlock of the standard, so lock_guard, unique_lock and condition_variable_any take them as they are.
+namespace tk
+{
+	//Tells the core it's spinning. It stops speculating ahead on the load, so there's no pipeline flush when the line finally changes,
+	//and the other hyperthread gets the core meanwhile.
+	inline void CpuRelax()
+	{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+		_mm_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#endif
+	}
+
+	//Doubles the pauses between looks at the lock up to a cap, then starts giving the core away. Pure spinning collapses once there are more
+	//threads than cores, everyone burns whole time slices waiting on a holder that isn't even running.
+	class SpinBackoff
+	{
+	public:
+		void Wait()
+		{
+			if (m_pauses > MaxPauses)
+			{
+				std::this_thread::yield();
+				return;
+			}
+			for (uint32_t i = 0; i < m_pauses; i++)
+			{
+				CpuRelax();
+			}
+			m_pauses *= 2;
+		}
+
+	private:
+		static constexpr uint32_t MaxPauses = 256;
+		uint32_t m_pauses = 1;
+	};
+
+	//Test and test and set. Waiters spin on their shared copy of the line and only try the exchange once it looks free,
+	//so they don't keep stealing the line from the holder. Unfair, whoever's cache sees the release first gets it.
+	class TtasLock
+	{
+	public:
+		void lock()
+		{
+			SpinBackoff backoff;
+			while (m_locked.exchange(true, std::memory_order_acquire))
+			{
+				do
+				{
+					backoff.Wait();
+				} while (m_locked.load(std::memory_order_relaxed));
+			}
+		}
+
+		bool try_lock()
+		{
+			return !m_locked.load(std::memory_order_relaxed) && !m_locked.exchange(true, std::memory_order_acquire);
+		}
+
+		void unlock()
+		{
+			m_locked.store(false, std::memory_order_release);
+		}
+
+	private:
+		alignas(64) std::atomic<bool> m_locked = false;
+	};
+
+	//First come first served. Everyone takes a number and waits for it to come up, backing off longer the further back in line they are.
+	//Fair, but every release still invalidates every waiter's copy of m_serving.
+	class TicketLock
+	{
+	public:
+		void lock()
+		{
+			const uint32_t ticket = m_next.fetch_add(1, std::memory_order_relaxed);
+			for (uint32_t looks = 0;; looks++)
+			{
+				const uint32_t ahead = ticket - m_serving.load(std::memory_order_acquire);
+				if (ahead == 0) return;
+				if (looks >= MaxLooks)
+				{
+					std::this_thread::yield(); //See SpinBackoff.
+					continue;
+				}
+				for (uint32_t i = 0; i < ahead * PausesPerWaiter; i++)
+				{
+					CpuRelax();
+				}
+			}
+		}
+
+		bool try_lock()
+		{
+			const uint32_t serving = m_serving.load(std::memory_order_acquire); //What pairs with the last unlock, the exchange below is on m_next.
+			uint32_t next = serving;
+			return m_next.compare_exchange_strong(next, serving + 1, std::memory_order_acquire, std::memory_order_relaxed);
+		}
+
+		void unlock()
+		{
+			m_serving.store(m_serving.load(std::memory_order_relaxed) + 1, std::memory_order_release); //Only the holder writes it.
+		}
+
+	private:
+		static constexpr uint32_t PausesPerWaiter = 16;
+		static constexpr uint32_t MaxLooks = 64;
+
+		alignas(64) std::atomic<uint32_t> m_next = 0; //Apart from m_serving, so newcomers don't disturb the waiters.
+		alignas(64) std::atomic<uint32_t> m_serving = 0;
+	};
+
+	//Mellor-Crummey and Scott's queue lock. Waiters line up in a linked list and each spins on a flag in its own node, so a release touches
+	//exactly one other cache line however many are waiting. Fair like the ticket lock. The nodes come from a small per thread pool,
+	//so it keeps the standard lock interface instead of making callers pass one in.
+	class McsLock
+	{
+	public:
+		void lock()
+		{
+			Node* node = TakeNode_();
+			Node* previous = m_tail.exchange(node, std::memory_order_acq_rel);
+			if (previous)
+			{
+				previous->next.store(node, std::memory_order_release);
+				SpinBackoff backoff;
+				while (node->locked.load(std::memory_order_acquire))
+				{
+					backoff.Wait();
+				}
+			}
+			m_owner = node;
+		}
+
+		bool try_lock()
+		{
+			Node* node = TakeNode_();
+			Node* tail = nullptr;
+			if (!m_tail.compare_exchange_strong(tail, node, std::memory_order_acquire, std::memory_order_relaxed))
+			{
+				ReleaseNode_(node);
+				return false;
+			}
+			m_owner = node;
+			return true;
+		}
+
+		void unlock()
+		{
+			Node* node = m_owner;
+			Node* next = node->next.load(std::memory_order_acquire);
+			if (!next)
+			{
+				Node* tail = node;
+				if (m_tail.compare_exchange_strong(tail, nullptr, std::memory_order_release, std::memory_order_relaxed))
+				{
+					ReleaseNode_(node); //Nobody waiting.
+					return;
+				}
+				//Someone got in line behind us but hasn't linked up yet.
+				SpinBackoff backoff;
+				while (!(next = node->next.load(std::memory_order_acquire)))
+				{
+					backoff.Wait();
+				}
+			}
+			next->locked.store(false, std::memory_order_release);
+			ReleaseNode_(node);
+		}
+
+	private:
+		//Set up by TakeNode_ every time, no default member initializers since the thread_local pool below needs Node complete inside the class.
+		struct alignas(64) Node
+		{
+			std::atomic<Node*> next;
+			std::atomic<bool> locked;
+		};
+
+		//How many MCS locks one thread can hold or wait for at the same time.
+		static constexpr size_t NodesPerThread = 8;
+
+		static Node* TakeNode_()
+		{
+			const auto slot = size_t(std::countr_one(t_nodesInUse));
+			if (slot >= NodesPerThread) throw std::runtime_error{ "Too many McsLocks held by one thread" };
+			t_nodesInUse |= 1u << slot;
+			Node* node = &t_nodes[slot];
+			node->next.store(nullptr, std::memory_order_relaxed);
+			node->locked.store(true, std::memory_order_relaxed);
+			return node;
+		}
+
+		//Only once nobody else can touch it anymore, the successor has been handed the lock or there was none.
+		static void ReleaseNode_(Node* node)
+		{
+			t_nodesInUse &= ~(1u << (node - t_nodes.data()));
+		}
+
+		static inline thread_local std::array<Node, NodesPerThread> t_nodes;
+		static inline thread_local uint32_t t_nodesInUse = 0;
+
+		alignas(64) std::atomic<Node*> m_tail = nullptr;
+		Node* m_owner = nullptr; //Written and read by the holder only.
+	};
+
+	//Spins for a while before sleeping on a futex, through atomic wait/notify. Most critical sections are over before going to sleep would even
+	//have finished. How long it spins adapts the way glibc's adaptive mutex does, to a running average of how long the spins that paid off took.
+	//The sleeping part is Drepper's three state mutex from "Futexes are tricky", an unlock only makes the syscall when somebody might be asleep.
+	class SpinFutexLock
+	{
+	public:
+		void lock()
+		{
+			uint32_t state = Unlocked;
+			if (m_state.compare_exchange_strong(state, Locked, std::memory_order_acquire, std::memory_order_relaxed))
+			{
+				return;
+			}
+
+			const int32_t average = m_spins.load(std::memory_order_relaxed);
+			const int32_t limit = std::min(MaxSpins, average * 2 + 10);
+			for (int32_t spins = 0; spins < limit; spins++)
+			{
+				CpuRelax();
+				state = m_state.load(std::memory_order_relaxed);
+				if (state == Unlocked && m_state.compare_exchange_weak(state, Locked, std::memory_order_acquire, std::memory_order_relaxed))
+				{
+					m_spins.store(average + (spins - average) / 8, std::memory_order_relaxed); //We hold the lock, so nobody else writes this now.
+					return;
+				}
+			}
+			m_spins.store(average + (limit - average) / 8, std::memory_order_relaxed); //Could be spinning too briefly, let it grow. Racy, it's a hint.
+
+			//Whoever sleeps marks the lock, so the unlock knows it has to wake someone. Taking it this way leaves the mark on,
+			//there could be others asleep still.
+			state = m_state.exchange(Sleepers, std::memory_order_acquire);
+			while (state != Unlocked)
+			{
+				m_state.wait(Sleepers, std::memory_order_relaxed);
+				state = m_state.exchange(Sleepers, std::memory_order_acquire);
+			}
+		}
+
+		bool try_lock()
+		{
+			uint32_t state = Unlocked;
+			return m_state.compare_exchange_strong(state, Locked, std::memory_order_acquire, std::memory_order_relaxed);
+		}
+
+		void unlock()
+		{
+			if (m_state.exchange(Unlocked, std::memory_order_release) == Sleepers)
+			{
+				m_state.notify_one();
+			}
+		}
+
+	private:
+		static constexpr uint32_t Unlocked = 0;
+		static constexpr uint32_t Locked = 1;
+		static constexpr uint32_t Sleepers = 2;
+		static constexpr int32_t MaxSpins = 1000;
+
+		alignas(64) std::atomic<uint32_t> m_state = Unlocked; //32 bits, so wait/notify go straight to a futex.
+		std::atomic<int32_t> m_spins = 0;
+	};
+
+	template<LockKind Kind>
+	struct LockFor
+	{
+		using Type = std::mutex;
+	};
+
+	template<>
+	struct LockFor<LockKind::Ttas>
+	{
+		using Type = TtasLock;
+	};
+
+	template<>
+	struct LockFor<LockKind::Ticket>
+	{
+		using Type = TicketLock;
+	};
+
+	template<>
+	struct LockFor<LockKind::Mcs>
+	{
+		using Type = McsLock;
+	};
+
+	template<>
+	struct LockFor<LockKind::SpinFutex>
+	{
+		using Type = SpinFutexLock;
+	};
+
+	template<LockKind Kind>
+	using LockOf = typename LockFor<Kind>::Type;
+
+	//What the engines use unless told otherwise, see QueueLock in Globals.h.
+	using DefaultLock = LockOf<QueueLock>;
+
+	inline constexpr std::array<LockKind, 5> AllLockKinds = { LockKind::StdMutex, LockKind::Ttas, LockKind::Ticket, LockKind::Mcs, LockKind::SpinFutex };
+
+	inline const char* LockName(LockKind kind)
+	{
+		switch (kind)
+		{
+		case LockKind::Ttas: return "ttas";
+		case LockKind::Ticket: return "ticket";
+		case LockKind::Mcs: return "mcs";
+		case LockKind::SpinFutex: return "spin-futex";
+		default: return "std::mutex";
+		}
+	}
+
+	//Turns a lock picked at run time into a template argument, f.template operator()<Lock>() with the matching type, so a sweep over
+	//AllLockKinds can instantiate an engine per lock.
+	template<typename F>
+	decltype(auto) WithLock(LockKind kind, F&& f)
+	{
+		switch (kind)
+		{
+		case LockKind::Ttas: return f.template operator()<TtasLock>();
+		case LockKind::Ticket: return f.template operator()<TicketLock>();
+		case LockKind::Mcs: return f.template operator()<McsLock>();
+		case LockKind::SpinFutex: return f.template operator()<SpinFutexLock>();
+		default: return f.template operator()<std::mutex>();
+		}
+	}
+}
\ No newline at end of file
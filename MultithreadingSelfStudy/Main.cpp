@@ -10,6 +10,7 @@
 #include <numbers>
 #include <functional>
 #include <sstream>
+#include <string_view>
 #include <condition_variable>
 #include <deque>
 #include <optional>
@@ -22,288 +23,222 @@
 #include "Preassigned.h"
 #include "Queued.h"
 #include "AtomicQueued.h"
+#include "Hybrid.h"
+#include "Adaptive.h"
+#include "ThreadPool.h"
+#include "TaskGraph.h"
+#include "ThreadPoolBenchmarks.h"
+#include "MetricsEndpoint.h"
+#include "TransitionTable.h"
+#include "ChunkFile.h"
+#include "Pipeline.h"
+#include "ShardedIndex.h"
+#include "MultiProcess.h"
+#include "Workload.h"
+#include "LoadGenerator.h"
 
-namespace tk
+enum Datasets
 {
-    //Research templates
-    
-    template<typename T>
-    class SharedState
-    {
-    public: 
-        template<typename R> 
-        void Set(R&& result) //Promise
-        {
-            if (!m_result)
-            {
-                m_result = std::forward<R>(result); //Google what std::forward does. 
-                m_readySignal.release(); //Releases 1 count of the semaphore
-            }
-        }
+    STACKED,
+    EVENLY,
+    RANDOM,
+    PARETO, //From here on the per task cost distributions in Workload.h. 
+    LOGNORMAL,
+    BIMODAL,
+    HOTSPOTS,
+    DRIFT
+};
 
-        T Get() //Future, should sleep until the promise is set. 
-        {
-            m_readySignal.acquire(); //Blocks unless the value has been already set. 
-            return std::move(*m_result); 
-        }
-    private: 
-        std::binary_semaphore m_readySignal{ 0 }; //0, so no resources available yet. 
-        std::optional<T> m_result; //Result of asynchronous operation. google what std::optional does.  
-    };
+inline constexpr std::string_view DatasetNames[] = { "stacked", "evenly", "random", "pareto", "lognormal", "bimodal", "hotspots", "drift" }; 
 
-    template<>
-    class SharedState<void>
+Dataset GenerateDataset(Datasets run)
+{
+    switch (run)
     {
-    public:
-        void Set() //Promise
-        {
-            if (!m_complete)
-            {
-                m_complete = true; 
-                m_readySignal.release(); //Releases 1 count of the semaphore
-            }
-        }
-
-        void Get() //Future, should sleep until the promise is set. 
-        {
-            m_readySignal.acquire(); //Blocks unless the value has been already set. 
-           
-        }
-    private:
-        std::binary_semaphore m_readySignal{ 0 }; //0, so no resources available yet. 
-        bool m_complete = false; 
-    };
+    case Datasets::STACKED: return GenerateDatasetsStacked(); 
+    case Datasets::EVENLY: return GenerateDatasetsEvenly(); 
+    case Datasets::RANDOM: return GenerateDatasetsRandom(); 
+    default: return workload::Generate({ .shape = *workload::ShapeNamed(DatasetNames[run]) }); 
+    }
+}
 
-    template<typename T> 
-    class Promise; 
+//Generates one dataset and runs one engine over it. Picked from the command line, so the PGO build can train on every dataset
+//and the build comparison can time each variant the same way.
+int RunExperiment(Datasets run, std::string_view engine)
+{
+    // generate dataset
+    Dataset data = GenerateDataset(run); 
 
-    template<typename T>
-    class Future
+    if constexpr (UseTransitionTable)
     {
-        friend class Promise<T>; 
-    public:
-        T Get()
-        {
-            assert(!m_resultAcquired); 
-            m_resultAcquired = true; 
-            return m_PState->Get(); 
-        }
-
-    private:
-        Future(std::shared_ptr<SharedState<T>> pState) : m_PState{pState} //Can only be created by promise now
-        {}
-        std::shared_ptr<SharedState<T>> m_PState;
-        bool m_resultAcquired = false; 
-    };
-
+        TransitionTable::Instance(); //Build it before the experiment starts timing. 
+    }
 
-    template<typename T> 
-    class Promise
+    // run experiment
+    if (engine == "preassigned")
     {
-    public: 
-        Promise() : m_PState {std::make_shared<SharedState<T>>() }
-        {}
-        template<typename... R> 
-        void Set(R&&... result) //This is a parameterpack so we can forward 0 things. 
-        {
-            m_PState->Set(std::forward<R>(result)...); 
-        }
-       
-        Future<T> GetFuture()
-        {
-            assert(m_futureAvailable); 
-            m_futureAvailable = false; 
-            return { m_PState }; //Future thats constructed from PState. 
-        }
-
-    private: 
-        bool m_futureAvailable = true; 
-        std::shared_ptr<SharedState<T>> m_PState; 
-    };
-
- 
-    class Task
+        return preassigned::DoExperiment(data.Chunks()); 
+    }
+    if (engine == "queued")
     {
-    public: 
-        Task() = default; 
-        Task(const Task&) = delete; //no copy constructor, we only want to move tasks. 
-        Task(Task&& donor) noexcept : m_executor{ std::move(donor.m_executor) } {}
-        Task& operator=(const Task&) = delete; 
-        Task& operator=(Task&& rhs) noexcept
-        {
-            m_executor = std::move(rhs.m_executor); 
-            return *this; 
-        }
+        return queued::DoExperiment(data.Chunks()); 
+    }
+    if (engine == "hybrid")
+    {
+        return hybrid::DoExperiment(data.Chunks()); 
+    }
+    if (engine == "adaptive")
+    {
+        return adaptive::DoExperiment(data.Chunks()); 
+    }
+    return AtomicQueued::DoExperiment(data.Chunks()); 
+}
 
-        void operator()()
-        {
-            m_executor(); 
-        }
-        operator bool() const
-        {
-            return (bool)m_executor; 
-        }
-        template<typename F, typename...A>
-        static auto Make(F&& function, A&&... arguments) //Make a task. 
-        {
-            Promise<std::invoke_result_t<F, A...>> promise; 
-            auto future = promise.GetFuture(); 
-            return std::make_pair(
-                Task{ std::forward<F>(function), std::move(promise), std::forward<A>(arguments)... },
-                std::move(future)
-            ); 
-        }
+//Following along with video tutorial series by ChiliTomatoNoodle
 
+int main(int argc, char** argv)
+{
+    using namespace std::chrono_literals; 
 
-    private: 
-        template<typename F, typename P, typename...A>
-        Task(F&& function, P&& promise, A&&... arguments)
+    if (argc > 1 && std::string_view{ argv[1] } == "taskgraph")
+    {
+        return tk::DoTaskGraphBenchmark(); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "exceptions")
+    {
+        return tk::DoExceptionBenchmark(); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "futurelatency")
+    {
+        return tk::DoFutureLatencyBenchmark(); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "metrics")
+    {
+        //metrics, or metrics serve <port|/socket/path> [seconds]
+        if (argc > 3 && std::string_view{ argv[2] } == "serve")
         {
-            m_executor =
-                //Capture this
-                [
-                    function = std::forward<F>(function),
-                    promise = std::forward<P>(promise),
-                    ...arguments = std::forward<A>(arguments) //captures parameter pack
-                ]() mutable
-            {
-                if constexpr (std::is_void_v<std::invoke_result_t<F, A...>>)
-                {
-                    function(std::forward<A>(arguments)...); 
-                    promise.Set(); 
-                }
-                else
-                {
-                    promise.Set(function(std::forward<A>(arguments)...));
-                }
-            };
+            return tk::DoMetricsServe(argv[3], argc > 4 ? std::atoi(argv[4]) : 60); 
         }
-        std::function<void()> m_executor; 
-    };
-
-    class ThreadPool
+        return tk::DoPoolMetricsBenchmark(); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "timers")
+    {
+        return tk::DoTimerBenchmark(); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "affinity")
     {
-    public: 
-        ThreadPool(size_t numWorkers)
+        return tk::DoAffinityBenchmark(); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "fibers")
+    {
+        return tk::DoFiberBenchmark(); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "locks")
+    {
+        return tk::DoLockBenchmark(); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "generation")
+    {
+        return DoGenerationBenchmark(); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "workloads")
+    {
+        return workload::DoWorkloadBenchmark(); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "load")
+    {
+        //load [poisson|constant] [random|pareto|lognormal|bimodal|hotspots|drift]
+        const std::string_view arrivals = argc > 2 ? argv[2] : "poisson"; 
+        const std::string_view dataset = argc > 3 ? argv[3] : "random"; 
+        const auto shape = workload::ShapeNamed(dataset); 
+        if ((arrivals != "poisson" && arrivals != "constant") || (dataset != "random" && !shape))
         {
-            m_workers.reserve(numWorkers); 
-            for (size_t i = 0; i < numWorkers; i++)
-            {
-                m_workers.emplace_back(this); 
-            }
+            printf("Usage: %s load [poisson|constant] [random|pareto|lognormal|bimodal|hotspots|drift] \n", argv[0]); 
+            return 1; 
         }
-        template<typename F, typename...A> 
-        auto Run(F&& function, A&&... args)
+        return tk::DoLoadBenchmark(arrivals == "poisson" ? tk::Arrivals::Poisson : tk::Arrivals::Constant, shape); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "transitiontable")
+    {
+        return DoTransitionTableBenchmark(); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "chunkfile")
+    {
+        return DoChunkFileBenchmark(); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "pipeline")
+    {
+        return pipeline::DoPipelineBenchmark(); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "sharding")
+    {
+        return DoShardedIndexBenchmark(); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "multiprocess")
+    {
+        //multiprocess [process counts...], 1 2 4 by default.
+        std::vector<size_t> processCounts;
+        for (int i = 2; i < argc; i++)
         {
-            auto [task, future] = Task::Make(std::forward<F>(function), std::forward<A>(args)...); 
-            {
-                std::lock_guard lk {m_taskQueueMtx};
-                m_tasks.push_back(std::move(task));
-            } //We want to release the mutex before notifying the condition variable. 
-            m_cv.notify_one(); 
-            return future; 
+            processCounts.push_back(std::max(1, std::atoi(argv[i]))); 
         }
-
-        Task GetTask(std::stop_token& st)
+        if (processCounts.empty()) processCounts = { 1, 2, 4 }; 
+        return multiprocess::DoMultiProcessBenchmark(processCounts); 
+    }
+    if (argc > 3 && std::string_view{ argv[1] } == "mpworker")
+    {
+        //Started by multiprocess, not meant to be run by hand.
+        return multiprocess::RunWorkerProcess(argv[2], size_t(std::atoi(argv[3]))); 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "engines")
+    {
+        //Every dataset through every chunk engine, one after the other.
+        for (size_t run = 0; run < std::size(DatasetNames); run++)
         {
-            //This is done among a single mutex. If something locks a mutex, it will be unavailable to all other things that have access to the mutex. 
-            Task task; 
-            std::unique_lock lk {m_taskQueueMtx}; 
-            m_cv.wait(lk, st, [this] {return !m_tasks.empty(); });
-            if (!st.stop_requested())
+            for (const std::string_view engine : { "preassigned", "queued", "atomicqueued", "hybrid", "adaptive" })
             {
-                task = std::move(m_tasks.front()); 
-                m_tasks.pop_front(); 
-                if (m_tasks.empty())
-                {
-                    m_AllDonecv.notify_all(); //Notify all the people waiting for this condition. 
-                }
+                printf("%.*s, %.*s: ", int(DatasetNames[run].size()), DatasetNames[run].data(), int(engine.size()), engine.data()); 
+                RunExperiment(Datasets(run), engine); 
             }
-            return task; //We can check for empty task in the call. 
         }
-
-        void WaitForAllDone()
-        {
-            std::unique_lock lk {m_taskQueueMtx}; 
-            m_AllDonecv.wait(lk, [this] {return m_tasks.empty(); }); //Block when task queue is empty.
-        }
-
-        ~ThreadPool()
+        return 0; 
+    }
+    if (argc > 1 && std::string_view{ argv[1] } == "experiment")
+    {
+        //experiment <stacked|evenly|random|pareto|lognormal|bimodal|hotspots|drift> [preassigned|queued|atomicqueued|hybrid|adaptive]
+        const std::string_view dataset = argc > 2 ? argv[2] : "stacked"; 
+        const std::string_view engine = argc > 3 ? argv[3] : "atomicqueued"; 
+        const auto run = std::ranges::find(DatasetNames, dataset); 
+        if (run == std::end(DatasetNames)
+            || (engine != "preassigned" && engine != "queued" && engine != "atomicqueued" && engine != "hybrid" && engine != "adaptive"))
         {
-            for (auto& w : m_workers)
-            {
-                w.RequestStop(); 
-            }
+            printf("Usage: %s experiment <stacked|evenly|random|pareto|lognormal|bimodal|hotspots|drift> [preassigned|queued|atomicqueued|hybrid|adaptive] \n", argv[0]); 
+            return 1; 
         }
-
-    private: 
-
-        class Worker
-        {
-        public:
-            Worker(ThreadPool* pool) : m_PPool{ pool }, m_thread(std::bind_front(&Worker::RunKernel, this))
-            {
-
-            }
-            void RequestStop()
-            {
-                m_thread.request_stop(); 
-            }
-
-        private:
-            void RunKernel(std::stop_token st) //Jthread thing
-            {
-               
-                while (auto task = m_PPool->GetTask(st))
-                {
-                    task(); 
-                }
-     
-            }
-            ThreadPool* m_PPool; 
-            std::jthread m_thread;
-        };
-
-        //Data
-        std::mutex m_taskQueueMtx; 
-        std::condition_variable_any m_cv; 
-        std::condition_variable_any m_AllDonecv;
-        std::deque<Task> m_tasks; 
-        std::vector<Worker> m_workers; 
-
-    };
-}
-
-enum Datasets
-{
-    STACKED,
-    EVENLY,
-    RANDOM
-};
-//Following along with video tutorial series by ChiliTomatoNoodle
-
-int main(int argc, char** argv)
-{
-    using namespace std::chrono_literals; 
+        return RunExperiment(Datasets(run - std::begin(DatasetNames)), engine); 
+    }
 
     
     tk::ThreadPool pool(WORKER_COUNT); 
 
     const auto spitt = []
     {
-        std::this_thread::sleep_for(500ms);
         std::ostringstream ss;
         ss << std::this_thread::get_id();
-        std::cout << std::format("<< {} >> ", ss.str()) << std::flush;
+        std::cout << "<< " << ss.str() << " >> " << std::flush;
        
     };
 
+    std::vector<tk::Future<void>> spitts; 
     for (int i = 0; i < 32; i++)
     {
-        pool.Run(spitt); 
+        spitts.push_back(pool.RunAfter(500ms, spitt)); //The wait happens on the timer thread, none of the workers sleep through it. 
     }
 
-    pool.WaitForAllDone(); 
+    for (auto& spittFuture : spitts)
+    {
+        spittFuture.Get(); 
+    }
     
 
     tk::Promise<int> promise; 
@@ -326,21 +261,4 @@ int main(int argc, char** argv)
     std::cout << future.Get() << std::endl; 
 
     return 0; 
-    /*
-    Datasets run = Datasets::STACKED; 
-
-    // generate dataset
-    std::vector<std::array<Task, CHUNK_SIZE>> data;
-    if (run == Datasets::STACKED) {
-        data = GenerateDatasetsStacked();
-    }
-    else if (run == Datasets::EVENLY) {
-        data = GenerateDatasetsEvenly();
-    }
-    else {
-        data = GenerateDatasetsRandom();
-    }
-
-    // run experiment
-    return AtomicQueued::DoExperiment(data); */
 }
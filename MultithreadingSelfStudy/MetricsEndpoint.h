@@ -0,0 +1,150 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include "Globals.h"
+#include "PoolMetrics.h"
+#include "ThreadPool.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace tk
+{
+	//Answers every connection with whatever the source returns, as a bare HTTP/1.0 response, so Prometheus, curl or curl --unix-socket can scrape it.
+	//A number is a port on 127.0.0.1, anything starting with '/' is a Unix socket path. Scrapes are served one at a time on the endpoint's own thread.
+	class MetricsEndpoint
+	{
+	public:
+		using Source = std::function<std::string()>;
+
+		MetricsEndpoint(std::string_view address, Source source) : m_source{ std::move(source) }
+		{
+#ifndef _WIN32
+			if (!address.empty() && address.front() == '/')
+			{
+				sockaddr_un local{};
+				local.sun_family = AF_UNIX;
+				if (address.size() >= sizeof(local.sun_path)) throw std::runtime_error{ "Socket path too long" };
+				address.copy(local.sun_path, address.size());
+				m_path = address;
+				unlink(m_path.c_str()); //Left over from an earlier run.
+				Listen_(AF_UNIX, reinterpret_cast<const sockaddr*>(&local), sizeof(local));
+			}
+			else
+			{
+				sockaddr_in local{};
+				local.sin_family = AF_INET;
+				local.sin_port = htons(uint16_t(std::atoi(std::string{ address }.c_str())));
+				local.sin_addr.s_addr = htonl(INADDR_LOOPBACK); //Never reachable from outside the box.
+				Listen_(AF_INET, reinterpret_cast<const sockaddr*>(&local), sizeof(local));
+			}
+			m_thread = std::jthread{ std::bind_front(&MetricsEndpoint::Serve_, this) };
+#else
+			(void)address;
+			throw std::runtime_error{ "The metrics endpoint needs POSIX sockets" };
+#endif
+		}
+
+		MetricsEndpoint(const MetricsEndpoint&) = delete;
+		MetricsEndpoint& operator=(const MetricsEndpoint&) = delete;
+
+		~MetricsEndpoint()
+		{
+#ifndef _WIN32
+			m_thread.request_stop();
+			if (m_thread.joinable()) m_thread.join();
+			close(m_listener);
+			if (!m_path.empty()) unlink(m_path.c_str());
+#endif
+		}
+
+	private:
+#ifndef _WIN32
+		void Listen_(int family, const sockaddr* address, socklen_t size)
+		{
+			m_listener = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (m_listener < 0) throw std::runtime_error{ "Can't create the metrics socket" };
+			const int reuse = 1;
+			setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+			if (bind(m_listener, address, size) != 0 || listen(m_listener, 8) != 0)
+			{
+				close(m_listener);
+				throw std::runtime_error{ "Can't listen on the metrics address" };
+			}
+		}
+
+		void Serve_(std::stop_token st)
+		{
+			while (!st.stop_requested())
+			{
+				pollfd waiting{ .fd = m_listener, .events = POLLIN, .revents = 0 };
+				if (poll(&waiting, 1, 100) <= 0) continue; //Wakes up now and then to see if we're shutting down.
+				const int client = accept4(m_listener, nullptr, nullptr, SOCK_CLOEXEC);
+				if (client < 0) continue;
+
+				//The request doesn't matter, every path gets the metrics. Read what's there so the client doesn't see a reset.
+				char request[1024];
+				pollfd readable{ .fd = client, .events = POLLIN, .revents = 0 };
+				if (poll(&readable, 1, 100) > 0) (void)recv(client, request, sizeof(request), 0);
+
+				const std::string body = m_source();
+				const std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+				for (size_t sent = 0; sent < response.size();)
+				{
+					const auto written = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+					if (written <= 0) break;
+					sent += size_t(written);
+				}
+				close(client);
+			}
+		}
+
+		int m_listener = -1;
+		std::string m_path;
+#endif
+		Source m_source;
+		std::jthread m_thread; //Declared last, so everything Serve_ touches is there before it starts.
+	};
+
+	//Keeps a pool with metrics busy with bursts of uneven tasks for the given number of seconds and serves its metrics meanwhile,
+	//e.g. curl localhost:9100 or curl --unix-socket /tmp/tk.sock http://localhost/metrics.
+	int DoMetricsServe(std::string_view address, int seconds)
+	{
+		ThreadPool pool(WORKER_COUNT, ShutdownMode::Drain, true);
+		MetricsEndpoint endpoint{ address, [&pool] { return ToPrometheusText(pool.ReadMetrics(), "main"); } };
+		printf("Serving metrics on %.*s for %d seconds \n", int(address.size()), address.data(), seconds);
+
+		std::mt19937 random{ DatasetSeed };
+		std::uniform_int_distribution<int> burst{ 1, 200 };
+		std::uniform_int_distribution<int> micros{ 1, 100 };
+		const auto end = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+		while (std::chrono::steady_clock::now() < end)
+		{
+			for (int i = burst(random); i > 0; i--)
+			{
+				const auto duration = std::chrono::microseconds(micros(random));
+				pool.Post([duration] {
+					const auto until = std::chrono::steady_clock::now() + duration;
+					while (std::chrono::steady_clock::now() < until) {}
+				});
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+		pool.WaitForAllDone();
+		printf("%s", ToPrometheusText(pool.ReadMetrics(), "main").c_str());
+		return 0;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,372 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Globals.h"
+#include "Task.h"
+#include "ThreadPool.h"
+#include "TransitionTable.h"
+#include "Timing.h"
+#include "Timer.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+//An experiment spread over several processes on one box, standing in for several nodes. The coordinator puts the dataset in a POSIX shared memory
+//segment and starts worker processes, each with its own tk::ThreadPool. They claim chunks through an atomic cursor in the segment and write their
+//results and per chunk timings back next to it, so a slow or noisy process shows up on its own.
+namespace multiprocess
+{
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "Atomics in shared memory have to be lock free to work across processes");
+
+	//Laid out at the start of the segment.
+	struct SegmentHeader
+	{
+		static constexpr std::array<char, 8> ExpectedMagic = { 'T', 'K', 'S', 'H', 'A', 'R', 'E', 'D' };
+
+		std::array<char, 8> magic = ExpectedMagic;
+		uint64_t chunkCount = 0;
+		uint64_t processCount = 0;
+		alignas(64) std::atomic<uint64_t> nextChunk = 0; //The shared cursor, on its own cache line.
+	};
+
+	struct ProcessResult
+	{
+		unsigned int accumulate = 0;
+		uint64_t chunksProcessed = 0;
+		float busyTime = 0.f; //Microseconds spent on chunks, out of the process' whole runtime.
+		float runTime = 0.f;
+	};
+
+	struct alignas(64) ChunkRecord
+	{
+		ChunkTimingInfo timing;
+		uint32_t process = 0;
+	};
+	static_assert(std::is_trivially_copyable_v<ChunkRecord>, "Records are read by another process, nothing in them can point into this one");
+
+	//Where everything sits in a segment for a given chunk and process count. Chunks are page aligned.
+	struct SegmentLayout
+	{
+		size_t recordsOffset;
+		size_t resultsOffset;
+		size_t chunksOffset;
+		size_t totalSize;
+
+		static SegmentLayout For(size_t chunkCount, size_t processCount)
+		{
+			constexpr size_t pageSize = 4096;
+			const auto alignUp = [](size_t offset, size_t alignment) { return (offset + alignment - 1) / alignment * alignment; };
+			SegmentLayout layout;
+			layout.recordsOffset = alignUp(sizeof(SegmentHeader), alignof(ChunkRecord));
+			layout.resultsOffset = alignUp(layout.recordsOffset + chunkCount * sizeof(ChunkRecord), 64);
+			layout.chunksOffset = alignUp(layout.resultsOffset + processCount * 64, pageSize); //A cache line per process result.
+			layout.totalSize = layout.chunksOffset + chunkCount * sizeof(Chunk);
+			return layout;
+		}
+	};
+
+#ifndef _WIN32
+	//A mapped shared memory segment. The one that created it also unlinks it.
+	class SharedSegment
+	{
+	public:
+		static SharedSegment Create(const std::string& name, size_t chunkCount, size_t processCount)
+		{
+			SharedSegment segment;
+			segment.m_name = name;
+			segment.m_owner = true;
+			const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+			if (fd < 0) throw std::runtime_error{ "Can't create shared memory segment " + name };
+			const auto layout = SegmentLayout::For(chunkCount, processCount);
+			if (ftruncate(fd, off_t(layout.totalSize)) != 0)
+			{
+				close(fd);
+				shm_unlink(name.c_str());
+				throw std::runtime_error{ "Can't size shared memory segment " + name };
+			}
+			segment.Map_(fd, layout.totalSize);
+
+			auto* header = new (segment.m_data) SegmentHeader{};
+			header->chunkCount = chunkCount;
+			header->processCount = processCount;
+			for (size_t p = 0; p < processCount; p++)
+			{
+				new (&segment.GetResult(p)) ProcessResult{};
+			}
+			for (size_t c = 0; c < chunkCount; c++)
+			{
+				new (&segment.GetRecords()[c]) ChunkRecord{};
+			}
+			return segment;
+		}
+
+		static SharedSegment Open(const std::string& name)
+		{
+			SharedSegment segment;
+			segment.m_name = name;
+			const int fd = shm_open(name.c_str(), O_RDWR, 0);
+			if (fd < 0) throw std::runtime_error{ "Can't open shared memory segment " + name };
+			struct stat info;
+			if (fstat(fd, &info) != 0)
+			{
+				close(fd);
+				throw std::runtime_error{ "Can't size up shared memory segment " + name };
+			}
+			segment.Map_(fd, size_t(info.st_size));
+			//The counts come from the segment. They're bounded by what could fit in it before the layout multiplies them,
+			//so a corrupt header can't wrap the size check around.
+			const auto fits = [&](uint64_t count, size_t each) { return count <= segment.m_size / each; };
+			if (segment.m_size < sizeof(SegmentHeader) || segment.GetHeader().magic != SegmentHeader::ExpectedMagic
+				|| !fits(segment.GetHeader().chunkCount, std::max(sizeof(Chunk), sizeof(ChunkRecord))) || !fits(segment.GetHeader().processCount, 64)
+				|| segment.m_size < SegmentLayout::For(segment.GetHeader().chunkCount, segment.GetHeader().processCount).totalSize)
+			{
+				throw std::runtime_error{ "Not an experiment segment: " + name };
+			}
+			return segment;
+		}
+
+		SharedSegment(SharedSegment&& donor) noexcept
+			: m_name{ std::move(donor.m_name) }, m_data{ std::exchange(donor.m_data, nullptr) }, m_size{ std::exchange(donor.m_size, 0) }, m_owner{ std::exchange(donor.m_owner, false) }
+		{}
+		SharedSegment(const SharedSegment&) = delete;
+		SharedSegment& operator=(const SharedSegment&) = delete;
+		~SharedSegment()
+		{
+			if (m_data) munmap(m_data, m_size);
+			if (m_owner) shm_unlink(m_name.c_str());
+		}
+
+		const std::string& GetName() const
+		{
+			return m_name;
+		}
+
+		SegmentHeader& GetHeader() const
+		{
+			return *static_cast<SegmentHeader*>(m_data);
+		}
+
+		std::span<ChunkRecord> GetRecords() const
+		{
+			return { reinterpret_cast<ChunkRecord*>(Base_() + Layout_().recordsOffset), GetHeader().chunkCount };
+		}
+
+		ProcessResult& GetResult(size_t process) const
+		{
+			return *reinterpret_cast<ProcessResult*>(Base_() + Layout_().resultsOffset + process * 64);
+		}
+
+		std::span<Chunk> GetChunks() const
+		{
+			return { reinterpret_cast<Chunk*>(Base_() + Layout_().chunksOffset), GetHeader().chunkCount };
+		}
+
+	private:
+		SharedSegment() = default;
+
+		void Map_(int fd, size_t size)
+		{
+			void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			close(fd); //The mapping keeps the segment alive.
+			if (data == MAP_FAILED) throw std::runtime_error{ "Can't map shared memory segment " + m_name };
+			m_data = data;
+			m_size = size;
+		}
+
+		char* Base_() const
+		{
+			return static_cast<char*>(m_data);
+		}
+
+		SegmentLayout Layout_() const
+		{
+			return SegmentLayout::For(GetHeader().chunkCount, GetHeader().processCount);
+		}
+
+		std::string m_name;
+		void* m_data = nullptr;
+		size_t m_size = 0;
+		bool m_owner = false;
+	};
+
+	//What a worker process runs. Claims chunks until the cursor runs past the end, splits each one over its pool like preassigned,
+	//and leaves a ChunkRecord per chunk and its totals in the segment.
+	int RunWorkerProcess(const std::string& segmentName, size_t process)
+	{
+		Timer runTimer;
+		runTimer.StartTimer();
+		auto segment = SharedSegment::Open(segmentName);
+		auto& header = segment.GetHeader();
+		const auto chunks = segment.GetChunks();
+		const auto records = segment.GetRecords();
+		if (process >= header.processCount) return 1;
+
+		if constexpr (UseTransitionTable)
+		{
+			TransitionTable::Instance(); //Every process builds its own, before it claims anything.
+		}
+
+		tk::ThreadPool pool(WORKER_COUNT);
+		ProcessResult result;
+		std::array<unsigned int, WORKER_COUNT> sums{};
+		std::vector<tk::Future<void>> futures;
+		futures.reserve(WORKER_COUNT);
+		Timer chunkTimer;
+		uint64_t index;
+		while ((index = header.nextChunk.fetch_add(1, std::memory_order_relaxed)) < header.chunkCount)
+		{
+			chunkTimer.StartTimer();
+			auto& record = records[index];
+			record.process = uint32_t(process);
+			const Chunk& chunk = chunks[index];
+			for (size_t w = 0; w < WORKER_COUNT; w++)
+			{
+				futures.push_back(pool.Run([&, w] {
+					Timer localTimer;
+					localTimer.StartTimer();
+					unsigned int sum = 0;
+					size_t heavy = 0;
+					for (const auto& task : std::span{ &chunk[w * SUBSET_SIZE], SUBSET_SIZE })
+					{
+						sum += ProcessTask(task);
+						heavy += task.heavy ? 1 : 0;
+					}
+					sums[w] += sum; //Once per subset, the slots share a cache line.
+					record.timing.numberOfHeavyItemsPerThread[w] = heavy;
+					record.timing.timeSpentWorkingPerThread[w] = localTimer.GetTime();
+				}));
+			}
+			for (auto& future : futures)
+			{
+				future.Get();
+			}
+			futures.clear();
+			record.timing.totalChunkTime = chunkTimer.GetTime();
+			result.busyTime += record.timing.totalChunkTime;
+			result.chunksProcessed++;
+		}
+
+		for (const auto sum : sums)
+		{
+			result.accumulate += sum;
+		}
+		result.runTime = runTimer.GetTime();
+		segment.GetResult(process) = result;
+		return 0;
+	}
+
+	//Runs the random dataset with 1, 2 and 4 worker processes (or the counts given) and prints how the chunks and the time split between them.
+	//The per chunk records of the last run go to multiprocess.csv, unless one of its processes failed.
+	int DoMultiProcessBenchmark(std::span<const size_t> processCounts)
+	{
+		bool failed = false;
+		for (const size_t processCount : processCounts)
+		{
+			const std::string name = "/mtss-" + std::to_string(getpid());
+			auto segment = SharedSegment::Create(name, CHUNK_COUNT, processCount);
+			{
+				tk::ThreadPool pool(WORKER_COUNT);
+				std::vector<tk::Future<void>> futures;
+				for (size_t i = 0; i < CHUNK_COUNT; i++)
+				{
+					futures.push_back(pool.Run([&chunk = segment.GetChunks()[i], i] { FillChunkRandom(chunk, i); }));
+				}
+				for (auto& future : futures)
+				{
+					future.Get();
+				}
+			}
+
+			//Started as fresh processes of this same binary, not forked, so they don't inherit anything from our threads.
+			Timer timer;
+			timer.StartTimer();
+			std::vector<pid_t> children;
+			for (size_t p = 0; p < processCount; p++)
+			{
+				std::string indexArgument = std::to_string(p);
+				char* argv[] = { const_cast<char*>("MultithreadingSelfStudy"), const_cast<char*>("mpworker"), const_cast<char*>(name.c_str()), indexArgument.data(), nullptr };
+				pid_t child;
+				if (posix_spawn(&child, "/proc/self/exe", nullptr, nullptr, argv, environ) != 0)
+				{
+					printf("Couldn't start worker process %zu \n", p);
+					continue;
+				}
+				children.push_back(child);
+			}
+			bool allSucceeded = children.size() == processCount;
+			for (const pid_t child : children)
+			{
+				int status = 0;
+				waitpid(child, &status, 0);
+				allSucceeded &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+			}
+			const float timeElapsed = timer.GetTime();
+
+			unsigned int answer = 0;
+			printf("%zu processes x %zu threads: %f microseconds%s \n", processCount, WORKER_COUNT, timeElapsed, allSucceeded ? "" : " (a worker process failed)");
+			for (size_t p = 0; p < processCount; p++)
+			{
+				const auto& result = segment.GetResult(p);
+				answer += result.accumulate;
+				printf("  process %zu: %llu chunks, busy %f of %f microseconds \n", p, (unsigned long long)result.chunksProcessed, result.busyTime, result.runTime);
+			}
+			if (!allSucceeded)
+			{
+				//Chunks the failed process claimed may never have been processed, so the sum and the chunk records are incomplete.
+				printf("Result is invalid, not every worker process finished \n");
+				failed = true;
+				continue;
+			}
+			printf("Result is %u \n", answer);
+
+			if (processCount == processCounts.back())
+			{
+				std::ofstream csv{ "multiprocess.csv", std::ios_base::trunc };
+				csv << "chunk;process;chunktime;total_heavy\n";
+				for (size_t c = 0; c < CHUNK_COUNT; c++)
+				{
+					const auto& record = segment.GetRecords()[c];
+					size_t heavy = 0;
+					for (const auto count : record.timing.numberOfHeavyItemsPerThread)
+					{
+						heavy += count;
+					}
+					csv << c << ';' << record.process << ';' << record.timing.totalChunkTime << ';' << heavy << '\n';
+				}
+			}
+		}
+		return failed ? 1 : 0;
+	}
+#else
+	int RunWorkerProcess(const std::string&, size_t)
+	{
+		printf("Multi process runs need POSIX shared memory \n");
+		return 1;
+	}
+
+	int DoMultiProcessBenchmark(std::span<const size_t>)
+	{
+		printf("Multi process runs need POSIX shared memory \n");
+		return 1;
+	}
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,209 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <span>
+#include <utility>
+#include "Globals.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+enum class PerfEvent
+{
+	Cycles,
+	Instructions,
+	LLCMisses,
+	L1DMisses,
+	BranchMisses,
+	ContextSwitches,
+	CpuMigrations,
+	Count
+};
+
+inline constexpr size_t PerfEventCount = size_t(PerfEvent::Count);
+inline constexpr std::array<const char*, PerfEventCount> PerfEventNames = { "cycles", "instructions", "llc_misses", "l1d_misses", "branch_misses", "context_switches", "cpu_migrations" };
+
+//Counter values at one point in time, or the difference between two. Events the machine or the kernel wouldn't give us are left out of the mask.
+struct PerfSample
+{
+	std::array<uint64_t, PerfEventCount> values{};
+	uint32_t availableMask = 0;
+
+	bool Has(PerfEvent event) const
+	{
+		return availableMask & (1u << size_t(event));
+	}
+
+	uint64_t operator[](PerfEvent event) const
+	{
+		return values[size_t(event)];
+	}
+
+	PerfSample operator-(const PerfSample& rhs) const
+	{
+		PerfSample delta;
+		delta.availableMask = availableMask & rhs.availableMask;
+		for (size_t i = 0; i < PerfEventCount; i++)
+		{
+			delta.values[i] = values[i] - rhs.values[i];
+		}
+		return delta;
+	}
+};
+
+//One perf_event_open group counting for the thread that constructed it. All events sit in a single group,
+//so they're scheduled on the PMU together and one read() gets all of them.
+//Any event that can't be opened (no PMU in a VM, perf_event_paranoid, not Linux) is just missing from the samples,
+//and with nothing opened Read returns an empty sample.
+class PerfCounters
+{
+public:
+	PerfCounters()
+	{
+#ifdef __linux__
+		struct EventConfig
+		{
+			uint32_t type;
+			uint64_t config;
+		};
+		constexpr std::array<EventConfig, PerfEventCount> configs = { {
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+			{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+			{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+			{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+			{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS }
+		} };
+
+		for (size_t i = 0; i < PerfEventCount; i++)
+		{
+			const int fd = Open_(configs[i].type, configs[i].config, m_groupFd);
+			if (fd < 0) continue;
+			if (m_groupFd < 0) m_groupFd = fd;
+			m_fds[i] = fd;
+			ioctl(fd, PERF_EVENT_IOC_ID, &m_ids[i]);
+			m_availableMask |= 1u << i;
+		}
+		if (m_groupFd >= 0)
+		{
+			ioctl(m_groupFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+			ioctl(m_groupFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+#endif
+	}
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+	PerfCounters(PerfCounters&& donor) noexcept
+		: m_fds{ std::exchange(donor.m_fds, ClosedFds) }, m_ids{ donor.m_ids }, m_groupFd{ std::exchange(donor.m_groupFd, -1) }, m_availableMask{ std::exchange(donor.m_availableMask, 0) }
+	{}
+	~PerfCounters()
+	{
+#ifdef __linux__
+		for (const int fd : m_fds)
+		{
+			if (fd >= 0) close(fd);
+		}
+#endif
+	}
+
+	bool IsAvailable() const
+	{
+		return m_availableMask != 0;
+	}
+
+	//Safe to call from any thread, the counts always belong to the thread that opened the group.
+	PerfSample Read() const
+	{
+		PerfSample sample;
+#ifdef __linux__
+		if (m_groupFd < 0) return sample;
+
+		//PERF_FORMAT_GROUP | ID | TOTAL_TIME_ENABLED | TOTAL_TIME_RUNNING layout.
+		struct
+		{
+			uint64_t count;
+			uint64_t timeEnabled;
+			uint64_t timeRunning;
+			struct
+			{
+				uint64_t value;
+				uint64_t id;
+			} entries[PerfEventCount];
+		} buffer;
+		if (read(m_groupFd, &buffer, sizeof(buffer)) <= 0) return sample;
+
+		//When more groups want the PMU than it has counters, the kernel time slices them. Scale up to an estimate of the full count.
+		const double scale = buffer.timeRunning && buffer.timeRunning < buffer.timeEnabled ? double(buffer.timeEnabled) / double(buffer.timeRunning) : 1.;
+		for (size_t e = 0; e < buffer.count && e < PerfEventCount; e++)
+		{
+			for (size_t i = 0; i < PerfEventCount; i++)
+			{
+				if (m_fds[i] >= 0 && m_ids[i] == buffer.entries[e].id)
+				{
+					sample.values[i] = uint64_t(double(buffer.entries[e].value) * scale);
+				}
+			}
+		}
+		sample.availableMask = buffer.timeRunning ? m_availableMask : 0;
+#endif
+		return sample;
+	}
+
+private:
+#ifdef __linux__
+	static int Open_(uint32_t type, uint64_t config, int groupFd)
+	{
+		perf_event_attr attr{};
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = groupFd < 0 ? 1 : 0; //Only the leader starts disabled, it switches the whole group on.
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		//perf_event_paranoid >= 2 only allows counting user space. Fine for the hardware events, but context switches and migrations
+		//only ever happen in the kernel, so those would read a misleading zero and are left out instead.
+		int fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0));
+		if (fd < 0 && type != PERF_TYPE_SOFTWARE)
+		{
+			attr.exclude_kernel = 1;
+			fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0));
+		}
+		return fd;
+	}
+#endif
+
+	static constexpr std::array<int, PerfEventCount> ClosedFds = { -1, -1, -1, -1, -1, -1, -1 };
+
+	std::array<int, PerfEventCount> m_fds = ClosedFds;
+	std::array<uint64_t, PerfEventCount> m_ids{};
+	int m_groupFd = -1;
+	uint32_t m_availableMask = 0;
+};
+
+//One line per worker, "-" for events that aren't available.
+void PrintPerfSamples(std::span<const PerfSample> samples)
+{
+	for (size_t w = 0; w < samples.size(); w++)
+	{
+		printf("Worker %zu:", w);
+		for (size_t i = 0; i < PerfEventCount; i++)
+		{
+			if (samples[w].Has(PerfEvent(i)))
+			{
+				printf(" %s %llu", PerfEventNames[i], (unsigned long long)samples[w].values[i]);
+			}
+			else
+			{
+				printf(" %s -", PerfEventNames[i]);
+			}
+		}
+		printf(" \n");
+	}
+}
\ No newline at end of file
@@ -0,0 +1,302 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <span>
+#include <thread>
+#include <vector>
+#include "Globals.h"
+#include "Task.h"
+#include "Timer.h"
+#include "AtomicQueued.h"
+
+namespace pipeline
+{
+	using Clock = std::chrono::steady_clock;
+
+	//Bounded lock-free MPMC queue (Vyukov). Every cell carries a sequence number that says whose turn it is,
+	//so producers and consumers only contend on their own position counter.
+	template<typename T, size_t Capacity>
+	class BoundedQueue
+	{
+		static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity has to be a power of two");
+	public:
+		BoundedQueue()
+		{
+			for (size_t i = 0; i < Capacity; i++)
+			{
+				m_cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		bool TryPush(T value)
+		{
+			size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+			while (true)
+			{
+				Cell& cell = m_cells[pos & (Capacity - 1)];
+				const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				const auto diff = std::ptrdiff_t(sequence) - std::ptrdiff_t(pos);
+				if (diff == 0)
+				{
+					if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						cell.value = std::move(value);
+						cell.sequence.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0)
+				{
+					return false; //Full.
+				}
+				else
+				{
+					pos = m_enqueuePos.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		bool TryPop(T& value)
+		{
+			size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+			while (true)
+			{
+				Cell& cell = m_cells[pos & (Capacity - 1)];
+				const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+				const auto diff = std::ptrdiff_t(sequence) - std::ptrdiff_t(pos + 1);
+				if (diff == 0)
+				{
+					if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						value = std::move(cell.value);
+						cell.sequence.store(pos + Capacity, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0)
+				{
+					return false; //Empty.
+				}
+				else
+				{
+					pos = m_dequeuePos.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+	private:
+		struct alignas(64) Cell
+		{
+			std::atomic<size_t> sequence;
+			T value;
+		};
+
+		std::array<Cell, Capacity> m_cells;
+		alignas(64) std::atomic<size_t> m_enqueuePos = 0;
+		alignas(64) std::atomic<size_t> m_dequeuePos = 0;
+	};
+
+	//Spins on a Try function, yielding the core, and returns how long that took. Stalls are rare and short when the pipeline is sized right.
+	template<typename F>
+	Clock::duration WaitFor(F&& tryFunction, const std::stop_token& st = {})
+	{
+		if (tryFunction()) return {};
+		const auto start = Clock::now();
+		while (!tryFunction() && !st.stop_requested())
+		{
+			std::this_thread::yield();
+		}
+		return Clock::now() - start;
+	}
+
+	//Generation and processing overlapped. PRODUCER_COUNT threads fill chunks into a fixed set of PIPELINE_BUFFERS buffers;
+	//the consumer side is a range of chunks the engines can iterate like a Dataset, in chunk index order whatever order the producers finish in.
+	//Processed buffers go back to the producers through a lock-free queue, so nothing is allocated after construction.
+	class Pipeline
+	{
+	public:
+		using FillFunction = void(*)(Chunk&, size_t);
+
+		Pipeline(FillFunction fill, size_t chunkCount) : m_fill{ fill }, m_chunkCount{ chunkCount }, m_buffers{ PIPELINE_BUFFERS }
+		{
+			for (uint32_t i = 0; i < PIPELINE_BUFFERS; i++)
+			{
+				m_free.TryPush(i);
+			}
+			m_latencies.reserve(chunkCount); //Recycle_ pushes one per chunk while the engine is timed, so it mustn't reallocate.
+			m_producers.reserve(PRODUCER_COUNT);
+			for (size_t i = 0; i < PRODUCER_COUNT; i++)
+			{
+				m_producers.emplace_back(std::bind_front(&Pipeline::Produce_, this));
+			}
+		}
+
+		class Iterator
+		{
+		public:
+			using difference_type = std::ptrdiff_t;
+			using value_type = std::span<const Task>;
+
+			Iterator() = default;
+			Iterator(Pipeline* pipeline, size_t index) : m_PPipeline{ pipeline }, m_index{ index }
+			{}
+
+			std::span<const Task> operator*() const
+			{
+				return m_PPipeline->Current_();
+			}
+			Iterator& operator++()
+			{
+				m_PPipeline->Recycle_();
+				m_index++;
+				return *this;
+			}
+			void operator++(int)
+			{
+				++*this;
+			}
+			bool operator==(const Iterator& rhs) const
+			{
+				return m_index == rhs.m_index;
+			}
+
+		private:
+			Pipeline* m_PPipeline = nullptr;
+			size_t m_index = 0;
+		};
+
+		Iterator begin()
+		{
+			return { this, 0 };
+		}
+
+		Iterator end()
+		{
+			return { this, m_chunkCount };
+		}
+
+		void PrintStats() const
+		{
+			const auto toMicro = [](Clock::duration d) { return std::chrono::duration<double, std::micro>(d).count(); };
+			const auto latencies = std::span{ m_latencies };
+			double sum = 0.;
+			double worst = 0.;
+			for (const auto latency : latencies)
+			{
+				sum += latency;
+				worst = std::max(worst, latency);
+			}
+			printf("Pipeline: %zu chunks, %zu producers, %zu buffers \n", m_chunkCount, PRODUCER_COUNT, PIPELINE_BUFFERS);
+			printf("Chunk latency, generation start to processed: average %f, worst %f microseconds \n", latencies.empty() ? 0. : sum / latencies.size(), worst);
+			printf("Producer stall waiting for a free buffer: %f microseconds (all producers) \n", toMicro(Clock::duration(m_producerStall.load())));
+			printf("Consumer stall waiting for a generated chunk: %f microseconds \n", toMicro(m_consumerStall));
+		}
+
+	private:
+		struct BufferInfo
+		{
+			size_t chunkIndex = 0;
+			Clock::time_point generationStart;
+		};
+
+		//The buffer is taken before the chunk index is claimed. So every claimed chunk the consumer hasn't finished has a buffer, which makes
+		//the next chunk the consumer needs always on its way, and leaves at most PIPELINE_BUFFERS chunks in flight, one per ready slot.
+		void Produce_(std::stop_token st)
+		{
+			while (true)
+			{
+				uint32_t buffer = 0;
+				const auto stall = WaitFor([&] { return m_free.TryPop(buffer); }, st);
+				m_producerStall.fetch_add(stall.count(), std::memory_order_relaxed);
+				if (st.stop_requested()) return;
+
+				const size_t index = m_nextChunk.fetch_add(1, std::memory_order_relaxed);
+				if (index >= m_chunkCount)
+				{
+					m_free.TryPush(buffer); //Can't be full, it only ever holds the buffers.
+					return;
+				}
+				m_info[buffer] = { .chunkIndex = index, .generationStart = Clock::now() };
+				m_fill(m_buffers.Chunks()[buffer], index);
+				auto& ready = m_ready[index % PIPELINE_BUFFERS];
+				ready.store(buffer + 1, std::memory_order_release);
+				ready.notify_one();
+			}
+		}
+
+		std::span<const Task> Current_()
+		{
+			if (!m_hasCurrent)
+			{
+				//Parked rather than spinning, so a consumer that's ahead leaves the cores to the producers.
+				auto& ready = m_ready[m_consumed % PIPELINE_BUFFERS];
+				uint32_t slot = ready.load(std::memory_order_acquire);
+				if (slot == 0)
+				{
+					const auto start = Clock::now();
+					do
+					{
+						ready.wait(0, std::memory_order_acquire);
+					} while ((slot = ready.load(std::memory_order_acquire)) == 0);
+					m_consumerStall += Clock::now() - start;
+				}
+				ready.store(0, std::memory_order_relaxed); //Before the buffer is freed, the chunk that gets this slot next needs it.
+				m_current = slot - 1;
+				m_hasCurrent = true;
+			}
+			return m_buffers.Chunks()[m_current];
+		}
+
+		//Called once the engine is done with the current chunk.
+		void Recycle_()
+		{
+			Current_();
+			m_latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - m_info[m_current].generationStart).count());
+			m_hasCurrent = false;
+			m_consumed++;
+			m_free.TryPush(m_current);
+		}
+
+		FillFunction m_fill;
+		size_t m_chunkCount;
+		Dataset m_buffers;
+		std::array<BufferInfo, PIPELINE_BUFFERS> m_info;
+		BoundedQueue<uint32_t, PIPELINE_BUFFERS> m_free;
+		std::array<std::atomic<uint32_t>, PIPELINE_BUFFERS> m_ready{}; //Chunk index modulo the buffer count, buffer + 1 once filled, 0 until then.
+		alignas(64) std::atomic<size_t> m_nextChunk = 0;
+		std::atomic<Clock::rep> m_producerStall = 0;
+
+		//Consumer side, only touched by the thread iterating.
+		uint32_t m_current = 0;
+		bool m_hasCurrent = false;
+		size_t m_consumed = 0;
+		Clock::duration m_consumerStall{};
+		std::vector<double> m_latencies;
+
+		std::vector<std::jthread> m_producers; //Last, so the producers are stopped and joined before anything they use goes away.
+	};
+
+	//Generate-then-process against the overlapped pipeline, on the random dataset with the AtomicQueued engine.
+	int DoPipelineBenchmark()
+	{
+		Timer timer;
+		{
+			timer.StartTimer();
+			tk::ThreadPool pool(WORKER_COUNT);
+			const Dataset data = GenerateDatasetsRandom(pool);
+			AtomicQueued::DoExperiment(data.Chunks());
+			printf("Generate, then process: %f microseconds end to end \n", timer.GetTime());
+		}
+		{
+			timer.StartTimer();
+			Pipeline pipe{ FillChunkRandom, CHUNK_COUNT };
+			AtomicQueued::DoExperiment(pipe);
+			printf("Pipelined: %f microseconds end to end \n", timer.GetTime());
+			pipe.PrintStats();
+		}
+		return 0;
+	}
+}
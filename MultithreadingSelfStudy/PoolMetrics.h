@@ -0,0 +1,256 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+namespace tk
+{
+	//What a ThreadPool's metrics add up to at one point in time. The counters are read one after the other while the pool keeps going,
+	//so they're only consistent with each other to within a few tasks.
+	struct PoolMetricsSnapshot
+	{
+		//Queue wait buckets, upper bounds of 1us, 4us, 16us ... about 1s, plus everything above.
+		static constexpr size_t WaitBucketCount = 11;
+
+		size_t workers = 0;
+		size_t busyWorkers = 0;
+		uint64_t queueDepth = 0;
+		uint64_t submitted = 0;
+		uint64_t completed = 0;
+		double busySeconds = 0.;
+		std::array<uint64_t, WaitBucketCount + 1> waitBuckets{}; //Not cumulative, the last one is +Inf.
+		double waitSeconds = 0.;
+		uint64_t waitCount = 0;
+		uint64_t detachedExceptions = 0; //Kept by the pool itself, there even without metrics.
+
+		static double WaitBucketBound(size_t bucket)
+		{
+			return double(uint64_t(1) << (2 * bucket)) * 1e-6;
+		}
+	};
+
+	//Lock free counters for one ThreadPool. Every worker only ever writes its own cache line, with plain relaxed stores instead of read-modify-writes,
+	//and a read adds the lines up. Only submissions from threads outside the pool share a counter, written under the pool's lock.
+	//The counts are exact. Clock reads are most of what the hooks would cost, so the queue wait and busy time are only measured for one task in
+	//SampleEvery, like adaptive's samples, and every measurement counts SampleEvery times. Over more than a few hundred tasks that's within noise.
+	class PoolMetrics
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		static constexpr uint32_t SampleEvery = 16;
+
+		explicit PoolMetrics(size_t workers) : m_workerCount{ workers }, m_workers{ std::make_unique<WorkerLine[]>(workers) }
+		{}
+
+		//Called on a worker thread before it takes its first task, so its submissions go to its own line.
+		void BindCurrentThread(size_t worker)
+		{
+			t_boundTo = this;
+			t_boundWorker = worker;
+		}
+
+		//Called with the pool's queue lock held. That already keeps submitters from outside the pool apart, so their shared counter gets by without
+		//a locked read-modify-write as well. That one was most of what the metrics cost a submission.
+		void OnSubmitted(uint64_t count = 1)
+		{
+			if (t_boundTo == this)
+			{
+				Add_(m_workers[t_boundWorker].submitted, count);
+			}
+			else
+			{
+				Add_(m_externalSubmitted, count);
+			}
+		}
+
+		//Queued tasks a cancelling shutdown threw away. Also under the queue lock. They count as taken off the queue, or the depth would never get back to 0.
+		void OnDiscarded(uint64_t count)
+		{
+			Add_(m_discarded, count);
+		}
+
+		//Whether the task about to be submitted from this thread gets stamped with its queueing time. Counted per thread, so it costs no shared write.
+		static bool SampleSubmission()
+		{
+			return t_submissions++ % SampleEvery == 0;
+		}
+
+		//queuedAt is left at its default by submissions that weren't sampled.
+		void OnDequeued(size_t worker, Clock::time_point queuedAt)
+		{
+			auto& line = m_workers[worker];
+			Add_(line.dequeued, 1);
+			const bool timeWait = queuedAt != Clock::time_point{};
+			line.timing = line.runs++ % SampleEvery == 0;
+			if (!timeWait && !line.timing) return;
+
+			line.dequeuedAt = Clock::now();
+			if (timeWait)
+			{
+				const auto wait = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(line.dequeuedAt - queuedAt).count());
+				Add_(line.waitNanos, wait * SampleEvery);
+				Add_(line.waitBuckets[WaitBucket_(wait)], SampleEvery);
+				Add_(line.waitCount, SampleEvery);
+			}
+		}
+
+		void OnStarted(size_t worker)
+		{
+			m_workers[worker].busy.store(true, std::memory_order_relaxed);
+		}
+
+		//Busy time counts from the dequeue, saving a clock read per task, the few instructions in between don't matter.
+		void OnFinished(size_t worker)
+		{
+			auto& line = m_workers[worker];
+			Add_(line.completed, 1);
+			AddBusy_(line);
+			line.busy.store(false, std::memory_order_relaxed);
+		}
+
+		//A task on a fiber parked in a Get. What it ran so far counts as busy, the wait doesn't, and it isn't completed yet.
+		void OnSuspended(size_t worker)
+		{
+			auto& line = m_workers[worker];
+			AddBusy_(line);
+			line.busy.store(false, std::memory_order_relaxed);
+		}
+
+		//Every stretch a worker runs a task for, from a dequeue or a resume, is sampled the same way.
+		void OnResumed(size_t worker)
+		{
+			auto& line = m_workers[worker];
+			line.timing = line.runs++ % SampleEvery == 0;
+			if (line.timing)
+			{
+				line.dequeuedAt = Clock::now();
+			}
+			line.busy.store(true, std::memory_order_relaxed);
+		}
+
+		PoolMetricsSnapshot Read() const
+		{
+			PoolMetricsSnapshot snapshot;
+			snapshot.workers = m_workerCount;
+			snapshot.submitted = m_externalSubmitted.load(std::memory_order_relaxed);
+			uint64_t dequeued = m_discarded.load(std::memory_order_relaxed);
+			uint64_t busyNanos = 0;
+			uint64_t waitNanos = 0;
+			uint64_t waitCount = 0;
+			for (size_t w = 0; w < m_workerCount; w++)
+			{
+				const auto& line = m_workers[w];
+				snapshot.submitted += line.submitted.load(std::memory_order_relaxed);
+				dequeued += line.dequeued.load(std::memory_order_relaxed);
+				snapshot.completed += line.completed.load(std::memory_order_relaxed);
+				snapshot.busyWorkers += line.busy.load(std::memory_order_relaxed) ? 1 : 0;
+				busyNanos += line.busyNanos.load(std::memory_order_relaxed);
+				waitNanos += line.waitNanos.load(std::memory_order_relaxed);
+				waitCount += line.waitCount.load(std::memory_order_relaxed);
+				for (size_t b = 0; b < snapshot.waitBuckets.size(); b++)
+				{
+					snapshot.waitBuckets[b] += line.waitBuckets[b].load(std::memory_order_relaxed);
+				}
+			}
+			snapshot.queueDepth = snapshot.submitted > dequeued ? snapshot.submitted - dequeued : 0; //A dequeue can be seen before its submission.
+			snapshot.busySeconds = double(busyNanos) * 1e-9;
+			snapshot.waitSeconds = double(waitNanos) * 1e-9;
+			snapshot.waitCount = waitCount; //Adds up like the buckets, so the histogram stays consistent.
+			return snapshot;
+		}
+
+	private:
+		//Only one thread writes at a time, so a load and a store is enough and nobody pays for a locked instruction.
+		static void Add_(std::atomic<uint64_t>& counter, uint64_t amount)
+		{
+			counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+		}
+
+		static size_t WaitBucket_(uint64_t nanos)
+		{
+			const uint64_t micros = (nanos + 999) / 1000;
+			if (micros <= 1) return 0;
+			return std::min<size_t>((std::bit_width(micros - 1) + 1) / 2, PoolMetricsSnapshot::WaitBucketCount); //Smallest power of 4 that fits.
+		}
+
+		struct alignas(64) WorkerLine
+		{
+			std::atomic<uint64_t> submitted = 0;
+			std::atomic<uint64_t> dequeued = 0;
+			std::atomic<uint64_t> completed = 0;
+			std::atomic<uint64_t> busyNanos = 0;
+			std::atomic<uint64_t> waitNanos = 0;
+			std::atomic<uint64_t> waitCount = 0;
+			std::array<std::atomic<uint64_t>, PoolMetricsSnapshot::WaitBucketCount + 1> waitBuckets{};
+			std::atomic<bool> busy = false;
+			//Only the owning worker touches these.
+			Clock::time_point dequeuedAt;
+			uint32_t runs = 0;
+			bool timing = false; //The stretch running right now is a sampled one.
+		};
+
+		static void AddBusy_(WorkerLine& line)
+		{
+			if (!line.timing) return;
+			line.timing = false;
+			Add_(line.busyNanos, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - line.dequeuedAt).count()) * SampleEvery);
+		}
+
+		static inline thread_local const PoolMetrics* t_boundTo = nullptr;
+		static inline thread_local size_t t_boundWorker = 0;
+		static inline thread_local uint32_t t_submissions = 0;
+
+		size_t m_workerCount;
+		std::unique_ptr<WorkerLine[]> m_workers;
+		alignas(64) std::atomic<uint64_t> m_externalSubmitted = 0;
+		std::atomic<uint64_t> m_discarded = 0; //Written under the same lock.
+	};
+
+	//Prometheus text exposition format, with the pool's name as a label so several pools can share one endpoint.
+	inline std::string ToPrometheusText(const PoolMetricsSnapshot& snapshot, std::string_view pool)
+	{
+		std::ostringstream out;
+		out.precision(9);
+		const std::string label = "pool=\"" + std::string{ pool } + "\"";
+		const auto metric = [&](const char* name, const char* type, const char* help, auto value) {
+			out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n' << name << '{' << label << "} " << value << '\n';
+		};
+
+		metric("tk_pool_workers", "gauge", "Worker threads in the pool.", snapshot.workers);
+		metric("tk_pool_busy_workers", "gauge", "Workers running a task right now.", snapshot.busyWorkers);
+		metric("tk_pool_idle_workers", "gauge", "Workers waiting for a task right now.", snapshot.workers - snapshot.busyWorkers);
+		metric("tk_pool_queue_depth", "gauge", "Tasks submitted but not picked up by a worker yet.", snapshot.queueDepth);
+		metric("tk_pool_tasks_submitted_total", "counter", "Tasks pushed through Run and Post.", snapshot.submitted);
+		metric("tk_pool_tasks_completed_total", "counter", "Tasks that finished running, cancelled ones included.", snapshot.completed);
+		metric("tk_pool_task_busy_seconds_total", "counter", "Time workers spent running tasks.", snapshot.busySeconds);
+		metric("tk_pool_detached_exceptions_total", "counter", "Exceptions thrown by Post tasks and RunEvery firings, which have nobody to report to.", snapshot.detachedExceptions);
+
+		out << "# HELP tk_pool_task_wait_seconds Time from submission until a worker took the task.\n# TYPE tk_pool_task_wait_seconds histogram\n";
+		uint64_t cumulative = 0;
+		for (size_t b = 0; b < snapshot.waitBuckets.size(); b++)
+		{
+			cumulative += snapshot.waitBuckets[b];
+			out << "tk_pool_task_wait_seconds_bucket{" << label << ",le=\"";
+			if (b < PoolMetricsSnapshot::WaitBucketCount)
+			{
+				out << PoolMetricsSnapshot::WaitBucketBound(b);
+			}
+			else
+			{
+				out << "+Inf";
+			}
+			out << "\"} " << cumulative << '\n';
+		}
+		out << "tk_pool_task_wait_seconds_sum{" << label << "} " << snapshot.waitSeconds << '\n';
+		out << "tk_pool_task_wait_seconds_count{" << label << "} " << snapshot.waitCount << '\n';
+		return out.str();
+	}
+}
\ No newline at end of file
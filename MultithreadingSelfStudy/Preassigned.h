@@ -3,10 +3,17 @@
 #include <thread>
 #include <mutex>
 #include <span>
-#include <format>
+#include <optional>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
 #include "Globals.h"
 #include "Task.h"
+#include "TransitionTable.h"
 #include "Timing.h"
+#include "PerfCounters.h"
 #include "Timer.h"
 
 namespace preassigned
@@ -98,6 +105,11 @@ namespace preassigned
 			return m_heavyItemsProcessed;
 		}
 
+		PerfSample GetChunkCounters() const
+		{
+			return m_chunkCounters;
+		}
+
 		~Worker()
 		{
 			Kill(); 
@@ -109,7 +121,7 @@ namespace preassigned
 			m_heavyItemsProcessed = 0;
 			for (const auto& task : m_input)
 			{
-				m_accumulate += task.Process();
+				m_accumulate += ProcessTask(task);
 				if constexpr (ChunkMeasurementEnabled)
 				{
 					m_heavyItemsProcessed += task.heavy ? 1 : 0;
@@ -122,6 +134,12 @@ namespace preassigned
 		{
 			std::unique_lock lk {m_mtx};
 			Timer localTimer;
+			std::optional<PerfCounters> counters; //Opened on this thread, so it counts this worker only.
+			PerfSample chunkStart;
+			if constexpr (ChunkMeasurementEnabled && PerfCountersEnabled)
+			{
+				counters.emplace();
+			}
 			while (true)
 			{
 				//1. Lock. 2. Extra condition. 
@@ -131,12 +149,20 @@ namespace preassigned
 				if constexpr (ChunkMeasurementEnabled)
 				{
 					localTimer.StartTimer();
+					if constexpr (PerfCountersEnabled)
+					{
+						chunkStart = counters->Read();
+					}
 				}
 				ProcessData_(); //Mutex remains locked when processing this. 
 
 				if constexpr (ChunkMeasurementEnabled)
 				{
 					m_workTime = localTimer.GetTime();
+					if constexpr (PerfCountersEnabled)
+					{
+						m_chunkCounters = counters->Read() - chunkStart;
+					}
 				}
 
 				m_input = {}; //Zero out input. 
@@ -145,7 +171,6 @@ namespace preassigned
 		}
 
 		ControlObject* m_PControl;
-		std::jthread m_thread;
 		std::condition_variable m_cv;
 		std::mutex m_mtx;
 
@@ -155,9 +180,13 @@ namespace preassigned
 		bool m_threadDying = false;
 		float m_workTime = -1.f;
 		size_t m_heavyItemsProcessed = 0;
+		PerfSample m_chunkCounters;
+		std::jthread m_thread; //Declared last, so everything Run touches is constructed before the thread starts. 
 	};
 
-	int DoExperiment(std::vector<std::array<Task, CHUNK_SIZE>> chunks)
+	//Chunks can be any range of chunks, a span over a Dataset or a ChunkStream reading from disk.
+	template<typename ChunkRange>
+	int DoExperiment(ChunkRange&& chunks)
 	{
 		std::vector<ChunkTimingInfo> timings;
 		timings.reserve(CHUNK_COUNT);
@@ -191,6 +220,7 @@ namespace preassigned
 				{
 					timings.back().numberOfHeavyItemsPerThread[i] = workerPtrs[i]->GetNumHeavyItemsProcessed();
 					timings.back().timeSpentWorkingPerThread[i] = workerPtrs[i]->GetJobWorkTime();
+					timings.back().countersPerThread[i] = workerPtrs[i]->GetChunkCounters();
 					timings.back().totalChunkTime = chunkTime;
 				}
 			}
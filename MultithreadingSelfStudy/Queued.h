@@ -3,14 +3,24 @@
 #include <thread>
 #include <mutex>
 #include <span>
-#include <format>
+#include <optional>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
 #include "Globals.h"
+#include "Locks.h"
 #include "Task.h"
+#include "TransitionTable.h"
 #include "Timing.h"
+#include "PerfCounters.h"
 #include "Timer.h"
 
 namespace queued
 {
+	//Lock is only what GetTask takes, once per task, so swapping it shows what the lock itself costs. See Locks.h.
+	template<typename Lock = tk::DefaultLock>
 	class ControlObject
 	{
 	public:
@@ -54,7 +64,7 @@ namespace queued
 
 		const Task* GetTask()
 		{
-			std::lock_guard lk {m_mtx};
+			std::lock_guard lk {m_taskMtx};
 			const auto i = m_index++; 
 			if (i >= CHUNK_SIZE)
 			{
@@ -67,16 +77,18 @@ namespace queued
 		std::condition_variable m_cv;
 		std::mutex m_mtx;
 		std::unique_lock<std::mutex> m_lk;
+		Lock m_taskMtx; //Apart from m_mtx, which the main thread holds whenever it isn't waiting. 
 		std::span<const Task> m_currentChunk; //Basically a flexible array. 
 		//SharedMemory 
 		int m_doneCount = 0;
 		size_t m_index = 0; 
 	};
 
+	template<typename Lock>
 	class Worker
 	{
 	public:
-		Worker(ControlObject* control) : m_PControl{ control }, m_thread{ &Worker::Run, this }
+		Worker(ControlObject<Lock>* control) : m_PControl{ control }, m_thread{ &Worker::Run, this }
 		{
 
 		}
@@ -115,6 +127,11 @@ namespace queued
 			return m_heavyItemsProcessed;
 		}
 
+		PerfSample GetChunkCounters() const
+		{
+			return m_chunkCounters;
+		}
+
 		~Worker()
 		{
 			Kill();
@@ -127,7 +144,7 @@ namespace queued
 			m_heavyItemsProcessed = 0;
 			while (auto pTask = m_PControl->GetTask()) //As long as there are still tasks, it will keep running. 
 			{
-				m_accumulate += pTask->Process();
+				m_accumulate += ProcessTask(*pTask);
 				if constexpr (ChunkMeasurementEnabled)
 				{
 					m_heavyItemsProcessed += pTask->heavy ? 1 : 0;
@@ -140,6 +157,12 @@ namespace queued
 		{
 			std::unique_lock lk {m_mtx};
 			Timer localTimer;
+			std::optional<PerfCounters> counters; //Opened on this thread, so it counts this worker only.
+			PerfSample chunkStart;
+			if constexpr (ChunkMeasurementEnabled && PerfCountersEnabled)
+			{
+				counters.emplace();
+			}
 			while (true)
 			{
 				//1. Lock. 2. Extra condition. 
@@ -149,12 +172,20 @@ namespace queued
 				if constexpr (ChunkMeasurementEnabled)
 				{
 					localTimer.StartTimer();
+					if constexpr (PerfCountersEnabled)
+					{
+						chunkStart = counters->Read();
+					}
 				}
 				ProcessData_(); //Mutex remains locked when processing this. 
 
 				if constexpr (ChunkMeasurementEnabled)
 				{
 					m_workTime = localTimer.GetTime();
+					if constexpr (PerfCountersEnabled)
+					{
+						m_chunkCounters = counters->Read() - chunkStart;
+					}
 				}
 
 				m_working = false; 
@@ -162,8 +193,7 @@ namespace queued
 			}
 		}
 
-		ControlObject* m_PControl;
-		std::jthread m_thread;
+		ControlObject<Lock>* m_PControl;
 		std::condition_variable m_cv;
 		std::mutex m_mtx;
 
@@ -172,10 +202,14 @@ namespace queued
 		bool m_threadDying = false;
 		float m_workTime = -1.f;
 		size_t m_heavyItemsProcessed = 0;
+		PerfSample m_chunkCounters;
 		bool m_working = false; 
+		std::jthread m_thread; //Declared last, so everything Run touches is constructed before the thread starts. 
 	};
 
-	int DoExperiment(std::vector<std::array<Task, CHUNK_SIZE>> chunks)
+	//Chunks can be any range of chunks, a span over a Dataset or a ChunkStream reading from disk.
+	template<typename Lock = tk::DefaultLock, typename ChunkRange>
+	int DoExperiment(ChunkRange&& chunks)
 	{
 		std::vector<ChunkTimingInfo> timings;
 		timings.reserve(CHUNK_COUNT);
@@ -183,10 +217,10 @@ namespace queued
 		Timer timer;
 		timer.StartTimer();
 
-		ControlObject mControl;
-		std::vector<std::unique_ptr<Worker>> workerPtrs(WORKER_COUNT);
+		ControlObject<Lock> mControl;
+		std::vector<std::unique_ptr<Worker<Lock>>> workerPtrs(WORKER_COUNT);
 
-		std::ranges::generate(workerPtrs, [m_PControl = &mControl] {return std::make_unique<Worker>(m_PControl); });
+		std::ranges::generate(workerPtrs, [m_PControl = &mControl] {return std::make_unique<Worker<Lock>>(m_PControl); });
 
 		Timer chunkTimer;
 
@@ -212,6 +246,7 @@ namespace queued
 				{
 					timings.back().numberOfHeavyItemsPerThread[i] = workerPtrs[i]->GetNumHeavyItemsProcessed();
 					timings.back().timeSpentWorkingPerThread[i] = workerPtrs[i]->GetJobWorkTime();
+					timings.back().countersPerThread[i] = workerPtrs[i]->GetChunkCounters();
 					timings.back().totalChunkTime = chunkTime;
 				}
 			}
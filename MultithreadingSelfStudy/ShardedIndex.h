@@ -0,0 +1,145 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include "Globals.h"
+#include "Topology.h"
+
+//A work counter split into shards, one per cache group. Every shard hands out its own slice of [0, size) from a counter on its own cache line,
+//so threads of one group only ever contend with each other. Once the own shard is drained, a thread helps out in the others.
+class ShardedIndex
+{
+public:
+	explicit ShardedIndex(size_t shardCount) : m_shards(std::max<size_t>(1, shardCount))
+	{}
+
+	size_t ShardCount() const
+	{
+		return m_shards.size();
+	}
+
+	//Not thread safe, happens between rounds.
+	void Reset(size_t size)
+	{
+		const size_t count = m_shards.size();
+		for (size_t s = 0; s < count; s++)
+		{
+			m_shards[s].next.store(size * s / count, std::memory_order_relaxed);
+			m_shards[s].end = size * (s + 1) / count;
+		}
+	}
+
+	//Next index, from the given shard first. False once every shard is drained.
+	bool Claim(size_t shard, size_t& index)
+	{
+		const size_t count = m_shards.size();
+		for (size_t k = 0; k < count; k++)
+		{
+			auto& candidate = m_shards[(shard + k) % count];
+			//Plain load first, so threads that moved on don't keep writing to a drained shard's cache line.
+			if (candidate.next.load(std::memory_order_relaxed) >= candidate.end) continue;
+			const size_t i = candidate.next.fetch_add(1, std::memory_order_relaxed);
+			if (i < candidate.end)
+			{
+				index = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	struct alignas(64) Shard
+	{
+		std::atomic<size_t> next = 0;
+		size_t end = 0;
+	};
+
+	std::vector<Shard> m_shards;
+};
+
+//Claims per second through one shared counter and through a ShardedIndex with a shard per cache group, from one thread up to every hardware thread.
+//Threads are pinned group by group and the work per claim is tiny, so the counter is what's being measured. Also written to sharding.csv.
+int DoShardedIndexBenchmark()
+{
+	constexpr size_t rounds = 2000;
+	constexpr size_t workPerClaim = 32;
+	const auto topology = CpuTopology::Detect();
+	const auto order = topology.CpuOrder();
+	topology.Print();
+
+	std::vector<size_t> threadCounts;
+	for (size_t threads = 1; threads < order.size(); threads *= 2)
+	{
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(order.size());
+
+	//Runs every round through claim(thread, index) on the given number of threads, reset() between rounds. Returns claims per second.
+	const auto measure = [&](size_t threads, auto&& reset, auto&& claim) {
+		reset();
+		std::barrier roundDone{ std::ptrdiff_t(threads), [&]() noexcept { reset(); } };
+		std::vector<unsigned> sinks(threads);
+		const auto start = std::chrono::steady_clock::now();
+		{
+			std::vector<std::jthread> pool;
+			for (size_t t = 0; t < threads; t++)
+			{
+				pool.emplace_back([&, t] {
+					PinCurrentThread(order[t]);
+					unsigned sink = 0;
+					for (size_t round = 0; round < rounds; round++)
+					{
+						size_t index;
+						while (claim(t, index))
+						{
+							for (size_t w = 0; w < workPerClaim; w++)
+							{
+								sink = sink * 31 + unsigned(index);
+							}
+						}
+						roundDone.arrive_and_wait();
+					}
+					sinks[t] = sink;
+				});
+			}
+		}
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return double(rounds * CHUNK_SIZE) / seconds;
+	};
+
+	std::ofstream csv{ "sharding.csv", std::ios_base::trunc };
+	csv << "threads;single;sharded;shards\n";
+	printf("threads, single counter, sharded (claims/sec) \n");
+	for (const size_t threads : threadCounts)
+	{
+		alignas(64) std::atomic<size_t> single = 0;
+		const double singleRate = measure(threads,
+			[&] { single.store(0, std::memory_order_relaxed); },
+			[&](size_t, size_t& index) { index = single.fetch_add(1, std::memory_order_relaxed); return index < CHUNK_SIZE; });
+
+		//Shards for the groups these threads actually landed in.
+		std::vector<size_t> shardOfThread(threads);
+		std::vector<size_t> groupsUsed;
+		for (size_t t = 0; t < threads; t++)
+		{
+			const size_t group = topology.GroupOf(order[t]);
+			const auto found = std::ranges::find(groupsUsed, group);
+			shardOfThread[t] = size_t(found - groupsUsed.begin());
+			if (found == groupsUsed.end()) groupsUsed.push_back(group);
+		}
+		ShardedIndex sharded{ groupsUsed.size() };
+		const double shardedRate = measure(threads,
+			[&] { sharded.Reset(CHUNK_SIZE); },
+			[&](size_t t, size_t& index) { return sharded.Claim(shardOfThread[t], index); });
+
+		printf("%zu, %f, %f (%zu shards) \n", threads, singleRate, shardedRate, sharded.ShardCount());
+		csv << threads << ';' << singleRate << ';' << shardedRate << ';' << sharded.ShardCount() << '\n';
+	}
+	return 0;
+}
\ No newline at end of file
@@ -4,74 +4,254 @@
 #include <ranges>
 #include <cmath>
 #include <numbers>
+#include <span>
+#include <memory>
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
 #include "Globals.h"
+#include "Arena.h"
+#include "ThreadPool.h"
+#include "Timer.h"
 
 struct Task
 {
+	//Tasks with at least this many iterations count as heavy, in the engines' statistics and as adaptive's second cost class.
+	static constexpr uint32_t HeavyFrom = uint32_t(LIGHT_ITERATIONS + HEAVY_ITERATIONS) / 2;
+
 	double val;
 	bool heavy;
+	uint32_t iterations; //Sits in what was padding after heavy, a Task is still 16 bytes.
+
+	static Task Make(double val, uint32_t iterations)
+	{
+		return Task{ .val = val, .heavy = iterations >= HeavyFrom, .iterations = iterations };
+	}
+
 	unsigned int Process() const
 	{
-		const auto iterations = heavy ? HEAVY_ITERATIONS : LIGHT_ITERATIONS;
 		double intermediate = val;
-		for (size_t i = 0; i < iterations; i++)
+		for (uint32_t i = 0; i < iterations; i++)
 		{
-			unsigned int digits = unsigned int(std::abs(std::sin(std::cos(intermediate) * std::numbers::pi) * 10000000)) % 100000; //Module slice out some digits.
-			intermediate = double(digits) / 10000.;
+			intermediate = double(Step(intermediate)) / 10000.;
 		}
-		return unsigned int(std::exp(intermediate));
+		return static_cast<unsigned int>(std::exp(intermediate));
+	}
+
+	//One iteration of Process. After the first one, the state is always one of these 100000 digit values.
+	static unsigned int Step(double intermediate)
+	{
+		return static_cast<unsigned int>(std::abs(std::sin(std::cos(intermediate) * std::numbers::pi) * 10000000)) % 100000; //Module slice out some digits.
 	}
 };
+static_assert(sizeof(Task) == 16);
 
+using Chunk = std::array<Task, CHUNK_SIZE>;
 
-std::vector<std::array<Task, CHUNK_SIZE>> GenerateDatasetsEvenly()
+//All chunks of an experiment in one arena. Engines only ever get a non-owning view, so nothing is copied before timing starts.
+class Dataset
 {
-	std::minstd_rand randomNumberEngine;
-	std::uniform_real_distribution dist {0., 2. * std::numbers::pi};
+public:
+	explicit Dataset(size_t chunkCount) : m_arena{ chunkCount * sizeof(Chunk) }
+	{
+		//Task is trivial, so this only starts the lifetimes, the pages stay untouched until generation writes them.
+		static_assert(std::is_trivially_default_constructible_v<Chunk>);
+		auto* first = static_cast<Chunk*>(m_arena.Data());
+		std::uninitialized_default_construct_n(first, chunkCount);
+		m_chunks = { first, chunkCount };
+	}
 
-	const int everyNth = int(1. / ProbabilityHeavy);
-	std::vector<std::array<Task, CHUNK_SIZE>> Chunks(CHUNK_COUNT);
+	std::span<Chunk> Chunks()
+	{
+		return m_chunks;
+	}
 
-	for (auto& chunk : Chunks)
+	std::span<const Chunk> Chunks() const
 	{
-		//Generate random ranges. Just make this long
-		std::ranges::generate(chunk, [&, acc = 0]() mutable {
-			bool heavy = false;
-			if ((acc += ProbabilityHeavy) >= 1.)
-			{
-				acc -= 1.;
-				heavy = true;
-			}
-			return Task{ .val = dist(randomNumberEngine), .heavy = heavy };
-			});
+		return m_chunks;
 	}
 
-	return Chunks;
-}
+	Arena::PageKind GetPageKind() const
+	{
+		return m_arena.GetPageKind();
+	}
+
+private:
+	Arena m_arena;
+	std::span<Chunk> m_chunks;
+};
+
 
-std::vector<std::array<Task, CHUNK_SIZE>> GenerateDatasetsStacked()
+//Counter based generator (SplitMix64). Each chunk gets its own stream seeded by its index, so chunks can be filled
+//in any order on any thread and the dataset is identical whatever the thread count.
+class ChunkRandom
 {
-	auto data = GenerateDatasetsEvenly();
-	for (auto& chunk : data)
+public:
+	explicit ChunkRandom(size_t chunkIndex) : m_state{ Mix_(DatasetSeed + chunkIndex) }
+	{}
+
+	uint64_t Next()
+	{
+		return Mix_(m_state += 0x9E3779B97F4A7C15ull);
+	}
+
+	//Uniform in [0, 1). Done by hand instead of with std distributions, those differ between standard libraries.
+	double NextUnit()
+	{
+		return double(Next() >> 11) * 0x1.0p-53;
+	}
+
+	//Standard normal, Box-Muller with the second value of the pair thrown away. 1 - NextUnit() is never 0, so the log is finite.
+	double NextNormal()
+	{
+		const double radius = std::sqrt(-2. * std::log(1. - NextUnit()));
+		return radius * std::cos(2. * std::numbers::pi * NextUnit());
+	}
+
+private:
+	static uint64_t Mix_(uint64_t z)
 	{
-		std::ranges::partition(chunk, std::identity{}, & Task::heavy);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
 	}
 
+	uint64_t m_state;
+};
+
+//Runs fill(chunk, chunkIndex) for every chunk as its own task on the pool and waits for all of them.
+template<typename F>
+Dataset GenerateChunksParallel(tk::ThreadPool& pool, F&& fill)
+{
+	Dataset data{ CHUNK_COUNT };
+	std::vector<tk::Future<void>> futures;
+	futures.reserve(CHUNK_COUNT);
+	for (size_t i = 0; i < CHUNK_COUNT; i++)
+	{
+		futures.push_back(pool.Run([&fill, &chunk = data.Chunks()[i], i] { fill(chunk, i); }));
+	}
+	for (auto& future : futures)
+	{
+		future.Get();
+	}
 	return data;
 }
 
-std::vector<std::array<Task, CHUNK_SIZE>> GenerateDatasetsRandom()
+void FillChunkEvenly(Chunk& chunk, size_t chunkIndex)
+{
+	ChunkRandom random{ chunkIndex };
+	//Generate random ranges. Just make this long
+	std::ranges::generate(chunk, [&, acc = 0.]() mutable {
+		bool heavy = false;
+		if ((acc += ProbabilityHeavy) >= 1.)
+		{
+			acc -= 1.;
+			heavy = true;
+		}
+		return Task::Make(random.NextUnit() * 2. * std::numbers::pi, uint32_t(heavy ? HEAVY_ITERATIONS : LIGHT_ITERATIONS));
+		});
+}
+
+Dataset GenerateDatasetsEvenly(tk::ThreadPool& pool)
+{
+	return GenerateChunksParallel(pool, FillChunkEvenly);
+}
+
+void FillChunkStacked(Chunk& chunk, size_t chunkIndex)
+{
+	FillChunkEvenly(chunk, chunkIndex);
+	std::ranges::partition(chunk, std::identity{}, &Task::heavy);
+}
+
+void FillChunkRandom(Chunk& chunk, size_t chunkIndex)
+{
+	ChunkRandom random{ chunkIndex };
+	//Generate random ranges. Just make this long
+	std::ranges::generate(chunk, [&] {
+		const double val = random.NextUnit() * 2. * std::numbers::pi;
+		return Task::Make(val, uint32_t(random.NextUnit() < ProbabilityHeavy ? HEAVY_ITERATIONS : LIGHT_ITERATIONS));
+		});
+}
+
+Dataset GenerateDatasetsStacked(tk::ThreadPool& pool)
+{
+	return GenerateChunksParallel(pool, FillChunkStacked);
+}
+
+Dataset GenerateDatasetsRandom(tk::ThreadPool& pool)
 {
-	std::minstd_rand randomNumberEngine;
-	std::uniform_real_distribution dist {0., 2. * std::numbers::pi};
-	std::bernoulli_distribution dist2 {ProbabilityHeavy};
-	std::vector<std::array<Task, CHUNK_SIZE>> Chunks(CHUNK_COUNT);
+	return GenerateChunksParallel(pool, FillChunkRandom);
+}
 
-	for (auto& chunk : Chunks)
+//Convenience overloads for when there's no pool around yet.
+Dataset GenerateDatasetsEvenly()
+{
+	tk::ThreadPool pool(WORKER_COUNT);
+	return GenerateDatasetsEvenly(pool);
+}
+
+Dataset GenerateDatasetsStacked()
+{
+	tk::ThreadPool pool(WORKER_COUNT);
+	return GenerateDatasetsStacked(pool);
+}
+
+Dataset GenerateDatasetsRandom()
+{
+	tk::ThreadPool pool(WORKER_COUNT);
+	return GenerateDatasetsRandom(pool);
+}
+
+//Times generating every dataset kind with 1, 4 and 32 pool threads, and checks every thread count produced the same data.
+int DoGenerationBenchmark()
+{
+	const auto hashDataset = [](const Dataset& data)
 	{
-		//Generate random ranges. Just make this long
-		std::ranges::generate(chunk, [&] { return Task{ .val = dist(randomNumberEngine), .heavy = dist2(randomNumberEngine) };  });
-	}
+		uint64_t hash = 1469598103934665603ull; //FNV-1a over the task values.
+		for (const auto& chunk : data.Chunks())
+		{
+			for (const auto& task : chunk)
+			{
+				hash = (hash ^ std::bit_cast<uint64_t>(task.val)) * 1099511628211ull;
+				hash = (hash ^ uint64_t(task.iterations)) * 1099511628211ull;
+			}
+		}
+		return hash;
+	};
+
+	const std::pair<const char*, Dataset(*)(tk::ThreadPool&)> generators[] = {
+		{ "stacked", GenerateDatasetsStacked },
+		{ "evenly", GenerateDatasetsEvenly },
+		{ "random", GenerateDatasetsRandom }
+	};
+
+	for (const auto& [name, generate] : generators)
+	{
+		uint64_t expectedHash = 0;
+		for (const size_t threads : { 1, 4, 32 })
+		{
+			tk::ThreadPool pool(threads);
+			const auto countersBefore = pool.ReadPerfCounters();
+			Timer timer;
+			timer.StartTimer();
+			const Dataset data = generate(pool);
+			const float timeElapsed = timer.GetTime();
 
-	return Chunks;
+			const uint64_t hash = hashDataset(data);
+			expectedHash = expectedHash ? expectedHash : hash;
+			printf("%s, %zu threads: %f microseconds, hash %016llx%s \n", name, threads, timeElapsed, (unsigned long long)hash, hash == expectedHash ? "" : " MISMATCH");
+			if constexpr (PerfCountersEnabled)
+			{
+				auto counters = pool.ReadPerfCounters();
+				for (size_t i = 0; i < counters.size(); i++)
+				{
+					counters[i] = counters[i] - countersBefore[i];
+				}
+				PrintPerfSamples(counters);
+			}
+		}
+	}
+	return 0;
 }
\ No newline at end of file
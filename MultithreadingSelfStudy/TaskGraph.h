@@ -0,0 +1,218 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <cassert>
+#include <cstdio>
+#include <exception>
+#include "Globals.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+
+namespace tk
+{
+	//A DAG of callables that is built once and executed many times on a ThreadPool.
+	//Every node has an atomic counter of unfinished predecessors. When a node finishes it decrements its successors,
+	//and whoever brings a counter to zero hands that node straight to the pool. Nothing is allocated per run.
+	class TaskGraph
+	{
+	public:
+		using NodeId = size_t;
+
+		//Dependencies have to exist already, so nodes are always added in topological order and the graph can't have cycles.
+		NodeId AddNode(std::function<void()> work, std::initializer_list<NodeId> dependencies = {})
+		{
+			const NodeId id = m_nodes.size();
+			m_nodes.push_back({ .work = std::move(work), .predecessorCount = dependencies.size(), .successors = {} });
+			for (const auto dep : dependencies)
+			{
+				assert(dep < id);
+				m_nodes[dep].successors.push_back(id);
+			}
+			m_compiled = false;
+			return id;
+		}
+
+		size_t Size() const
+		{
+			return m_nodes.size();
+		}
+
+		//Blocks until every node has run. Only one Run can be in flight per graph.
+		//If nodes throw, the rest of the graph still runs and the first exception is rethrown here.
+		void Run(ThreadPool& pool)
+		{
+			if (m_nodes.empty()) return;
+			if (!m_compiled)
+			{
+				Compile_();
+			}
+
+			for (size_t i = 0; i < m_nodes.size(); i++)
+			{
+				m_pending[i].store(m_nodes[i].predecessorCount, std::memory_order_relaxed);
+			}
+			m_completion->remaining.store(m_nodes.size(), std::memory_order_relaxed);
+			m_PPool = &pool;
+			m_exception = nullptr;
+			m_failed.store(false, std::memory_order_relaxed);
+
+			//Pushing through the pool's mutex publishes the counter resets to the workers.
+			for (const auto root : m_roots)
+			{
+				pool.Post([this, root] { RunNode_(root); });
+			}
+
+			//Wait for the last node to bring the counter to zero.
+			auto& remainingNodes = m_completion->remaining;
+			size_t remaining = remainingNodes.load(std::memory_order_acquire);
+			while (remaining != 0)
+			{
+				remainingNodes.wait(remaining, std::memory_order_acquire);
+				remaining = remainingNodes.load(std::memory_order_acquire);
+			}
+
+			if (m_exception)
+			{
+				std::rethrow_exception(std::exchange(m_exception, nullptr));
+			}
+		}
+
+	private:
+		struct Node
+		{
+			std::function<void()> work;
+			size_t predecessorCount = 0;
+			std::vector<NodeId> successors;
+		};
+
+		//Only happens the first time a graph is run after it was modified.
+		void Compile_()
+		{
+			m_pending = std::make_unique<std::atomic<size_t>[]>(m_nodes.size());
+			m_roots.clear();
+			for (NodeId i = 0; i < m_nodes.size(); i++)
+			{
+				if (m_nodes[i].predecessorCount == 0)
+				{
+					m_roots.push_back(i);
+				}
+			}
+			m_compiled = true;
+		}
+
+		void RunNode_(NodeId id)
+		{
+			//Once the last node brings the counter to zero, Run returns and the graph can be gone before that node's notify_all.
+			//The counter lives apart from the graph, so hold on to it. Taken while the graph is still there, the counter isn't zero yet.
+			const std::shared_ptr<Completion> completion = m_completion;
+
+			//Keep one ready successor for ourselves so a chain of nodes doesn't round trip through the queue.
+			while (true)
+			{
+				const Node& node = m_nodes[id];
+				try
+				{
+					node.work();
+				}
+				catch (...)
+				{
+					//Successors still have to be released, otherwise Run never returns.
+					if (!m_failed.exchange(true, std::memory_order_relaxed))
+					{
+						m_exception = std::current_exception();
+					}
+				}
+
+				NodeId next = id;
+				for (const auto succ : node.successors)
+				{
+					if (m_pending[succ].fetch_sub(1, std::memory_order_acq_rel) == 1)
+					{
+						if (next != id)
+						{
+							m_PPool->Post([this, next] { RunNode_(next); });
+						}
+						next = succ;
+					}
+				}
+
+				if (completion->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				{
+					completion->remaining.notify_all(); //Nothing of the graph may be touched from here on.
+					return;
+				}
+
+				if (next == id) return;
+				id = next;
+			}
+		}
+
+		struct Completion
+		{
+			std::atomic<size_t> remaining = 0;
+		};
+
+		std::vector<Node> m_nodes;
+		std::vector<NodeId> m_roots;
+		std::unique_ptr<std::atomic<size_t>[]> m_pending;
+		std::shared_ptr<Completion> m_completion = std::make_shared<Completion>(); //Allocated once per graph, not per run.
+		ThreadPool* m_PPool = nullptr;
+		std::exception_ptr m_exception; //Published to Run by the release on the remaining counter.
+		std::atomic<bool> m_failed = false;
+		bool m_compiled = false;
+	};
+
+	//Re-runs a 10k node graph (100 layers of 100, every node depending on two nodes of the previous layer) with near empty nodes,
+	//so the time per run is almost all scheduling overhead.
+	int DoTaskGraphBenchmark()
+	{
+		constexpr size_t layers = 100;
+		constexpr size_t width = 100;
+		constexpr size_t runs = 200;
+
+		ThreadPool pool(WORKER_COUNT);
+		TaskGraph graph;
+		std::atomic<size_t> counter = 0;
+		const auto work = [&counter] { counter.fetch_add(1, std::memory_order_relaxed); };
+
+		for (size_t layer = 0; layer < layers; layer++)
+		{
+			for (size_t i = 0; i < width; i++)
+			{
+				if (layer == 0)
+				{
+					graph.AddNode(work);
+				}
+				else
+				{
+					const size_t prevLayer = (layer - 1) * width;
+					graph.AddNode(work, { prevLayer + i, prevLayer + (i + 1) % width });
+				}
+			}
+		}
+
+		graph.Run(pool); //Warm up, also pays for compiling the graph.
+		counter = 0;
+
+		Timer timer;
+		timer.StartTimer();
+		for (size_t i = 0; i < runs; i++)
+		{
+			graph.Run(pool);
+		}
+		const float timeElapsed = timer.GetTime();
+
+		if (counter != runs * graph.Size())
+		{
+			printf("Ran %zu nodes, expected %zu \n", counter.load(), runs * graph.Size());
+			return 1;
+		}
+		printf("%zu runs of %zu nodes: %f microseconds \n", runs, graph.Size(), timeElapsed);
+		printf("%f microseconds per run, %f nanoseconds per node \n", timeElapsed / runs, timeElapsed * 1000.f / (runs * graph.Size()));
+		return 0;
+	}
+}
@@ -0,0 +1,1245 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+#include <deque>
+#include <optional>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <cassert>
+#include <atomic>
+#include <stdexcept>
+#include <stop_token>
+#include <exception>
+#include <latch>
+#include <chrono>
+#include "Fiber.h"
+#include "Globals.h"
+#include "Locks.h"
+#include "PerfCounters.h"
+#include "PoolMetrics.h"
+#include "TimerWheel.h"
+
+namespace tk
+{
+    //Research templates
+
+    //Thrown from Future::Get when the task was cancelled before it produced a result. 
+    class TaskCancelled : public std::runtime_error
+    {
+    public:
+        TaskCancelled() : std::runtime_error{ "tk task was cancelled" }
+        {}
+    };
+
+    //Everything about a shared state that doesn't depend on the result type, so a Task can cancel its promise without knowing T. 
+    //The whole state machine lives in one atomic word: Pending -> Setting -> Ready/Failed, or Pending -> Cancelled, 
+    //plus a bit that a blocked Get sets so a setter only pays for notify when somebody is actually waiting. 
+    //A Get on a fiber parks the fiber on m_fiberWaiters instead of sleeping on the word, so its worker thread can run something else. 
+    class SharedStateBase
+    {
+    public:
+        enum Status : uint32_t
+        {
+            Pending,
+            Setting, //A setter won the race and is writing the result. 
+            Ready,
+            Failed, //The callable threw, the exception is stored instead of a result. 
+            Cancelled
+        };
+
+        //Settles the state as cancelled if nobody has set it yet, and asks a running callable to stop. 
+        bool Cancel()
+        {
+            if (m_stopSource.stop_possible())
+            {
+                m_stopSource.request_stop(); 
+            }
+            return Claim_(Cancelled); //False when it was already set or cancelled. 
+        }
+
+        Status GetStatus() const
+        {
+            return Status(m_state.load(std::memory_order_acquire) & StatusMask); 
+        }
+
+        bool IsCancelled() const
+        {
+            return GetStatus() == Cancelled; 
+        }
+
+        //True when Get won't block anymore, whether that's because of a result, an exception or a cancel. 
+        bool IsReady() const
+        {
+            return GetStatus() >= Ready; 
+        }
+
+        //Only callables that take a std::stop_token pay for a stop state, everyone else just checks the status. 
+        std::stop_token EnableStopToken()
+        {
+            if (!m_stopSource.stop_possible())
+            {
+                m_stopSource = std::stop_source{}; 
+            }
+            return m_stopSource.get_token(); 
+        }
+
+        bool HasStopToken() const
+        {
+            return m_stopSource.stop_possible(); 
+        }
+
+        //Transports an exception to whoever calls Get, instead of letting it escape on the worker thread. 
+        void SetException(std::exception_ptr exception)
+        {
+            if (Claim_(Setting))
+            {
+                m_exception = std::move(exception); 
+                Publish_(Failed); 
+            }
+        }
+
+    protected:
+        static constexpr uint32_t StatusMask = 0b111; 
+        static constexpr uint32_t WaiterBit = 0b1000; 
+
+        //Moves the state out of Pending. Only one setter or canceller can win, so they don't race on the result. 
+        bool Claim_(Status status)
+        {
+            uint32_t state = m_state.load(std::memory_order_relaxed); 
+            while ((state & StatusMask) == Pending)
+            {
+                //Keep the waiter bit, it can be set at any point before we publish. 
+                if (m_state.compare_exchange_weak(state, (state & WaiterBit) | status, std::memory_order_acq_rel, std::memory_order_relaxed))
+                {
+                    if (status != Setting && (state & WaiterBit))
+                    {
+                        Wake_(); //Settled straight away, without a result to write. 
+                    }
+                    return true; 
+                }
+            }
+            return false; 
+        }
+
+        void Publish_(Status status)
+        {
+            //Dropping the waiter bit here is fine, once the state is settled nobody waits on it again. 
+            if (m_state.exchange(status, std::memory_order_acq_rel) & WaiterBit)
+            {
+                Wake_(); 
+            }
+        }
+
+        //Returns normally only when there is a result, otherwise throws whatever Get should throw. 
+        void Wait_()
+        {
+            uint32_t state = m_state.load(std::memory_order_acquire); 
+            if (state == Ready) [[likely]]
+            {
+                return; //Already set, so a Get is just this load. 
+            }
+
+            while ((state & StatusMask) < Ready)
+            {
+                if (!(state & WaiterBit))
+                {
+                    if (!m_state.compare_exchange_weak(state, state | WaiterBit, std::memory_order_acquire))
+                    {
+                        continue; 
+                    }
+                    state |= WaiterBit; 
+                }
+                if (auto* scheduler = FiberScheduler::Current())
+                {
+                    scheduler->Park(m_fiberWaiters); //Comes back once the state is settled. 
+                }
+                else
+                {
+                    m_state.wait(state, std::memory_order_acquire); 
+                }
+                state = m_state.load(std::memory_order_acquire); 
+            }
+
+            const auto status = state & StatusMask; 
+            if (status == Failed)
+            {
+                std::rethrow_exception(m_exception); 
+            }
+            if (status == Cancelled)
+            {
+                throw TaskCancelled{}; 
+            }
+        }
+
+    private:
+        //Threads and fibers both, the waiter bit doesn't tell which kind is waiting. 
+        void Wake_()
+        {
+            m_state.notify_all(); 
+            m_fiberWaiters.WakeAll(); 
+        }
+
+        std::atomic<uint32_t> m_state = Pending; //32 bits, so wait/notify can go straight to a futex. 
+        std::stop_source m_stopSource{ std::nostopstate }; 
+        std::exception_ptr m_exception; 
+        FiberWaitList m_fiberWaiters; 
+    };
+
+    template<typename T>
+    class SharedState : public SharedStateBase
+    {
+    public: 
+        template<typename R> 
+        void Set(R&& result) //Promise
+        {
+            if (Claim_(Setting))
+            {
+                m_result = std::forward<R>(result); //Google what std::forward does. 
+                Publish_(Ready); 
+            }
+        }
+
+        T Get() //Future, should sleep until the promise is set. 
+        {
+            Wait_(); 
+            return std::move(*m_result); 
+        }
+
+        //Never blocks. Empty while the result isn't there yet, otherwise behaves like Get. 
+        std::optional<T> TryGet()
+        {
+            if (!IsReady())
+            {
+                return std::nullopt; 
+            }
+            return Get(); 
+        }
+    private: 
+        std::optional<T> m_result; //Result of asynchronous operation. google what std::optional does.  
+    };
+
+    template<>
+    class SharedState<void> : public SharedStateBase
+    {
+    public:
+        void Set() //Promise
+        {
+            if (Claim_(Setting))
+            {
+                Publish_(Ready); 
+            }
+        }
+
+        void Get() //Future, should sleep until the promise is set. 
+        {
+            Wait_(); 
+        }
+
+        bool TryGet()
+        {
+            if (!IsReady())
+            {
+                return false; 
+            }
+            Get(); 
+            return true; 
+        }
+    };
+
+    template<typename T> 
+    class Promise; 
+
+    template<typename T>
+    class Future
+    {
+        friend class Promise<T>; 
+    public:
+        T Get()
+        {
+            assert(!m_resultAcquired); 
+            m_resultAcquired = true; 
+            return m_PState->Get(); 
+        }
+
+        //Never blocks, see SharedState::TryGet. 
+        auto TryGet()
+        {
+            assert(!m_resultAcquired); 
+            auto result = m_PState->TryGet(); 
+            m_resultAcquired = bool(result); 
+            return result; 
+        }
+
+        bool IsReady() const
+        {
+            return m_PState->IsReady(); 
+        }
+
+        //Nobody is interested anymore. A queued task is skipped, a running one is asked to stop through its stop_token. 
+        //Returns false if the result was already there. 
+        bool Cancel()
+        {
+            return m_PState->Cancel(); 
+        }
+
+        bool IsCancelled() const
+        {
+            return m_PState->IsCancelled(); 
+        }
+
+    private:
+        Future(std::shared_ptr<SharedState<T>> pState) : m_PState{pState} //Can only be created by promise now
+        {}
+        std::shared_ptr<SharedState<T>> m_PState;
+        bool m_resultAcquired = false; 
+    };
+
+
+    template<typename T> 
+    class Promise
+    {
+    public: 
+        Promise() : m_PState {std::make_shared<SharedState<T>>() }
+        {}
+        template<typename... R> 
+        void Set(R&&... result) //This is a parameterpack so we can forward 0 things. 
+        {
+            m_PState->Set(std::forward<R>(result)...); 
+        }
+
+        void SetException(std::exception_ptr exception)
+        {
+            m_PState->SetException(std::move(exception)); 
+        }
+
+        bool Cancel()
+        {
+            return m_PState->Cancel(); 
+        }
+
+        bool IsCancelled() const
+        {
+            return m_PState->IsCancelled(); 
+        }
+
+        std::stop_token GetStopToken()
+        {
+            return m_PState->EnableStopToken(); 
+        }
+
+        std::shared_ptr<SharedStateBase> GetState() const
+        {
+            return m_PState; 
+        }
+       
+        Future<T> GetFuture()
+        {
+            assert(m_futureAvailable); 
+            m_futureAvailable = false; 
+            return { m_PState }; //Future thats constructed from PState. 
+        }
+
+    private: 
+        bool m_futureAvailable = true; 
+        std::shared_ptr<SharedState<T>> m_PState; 
+    };
+
+ 
+    //Callables that accept a std::stop_token as their first parameter get the task's token, so they can bail out cooperatively. 
+    template<typename F, typename...A>
+    struct TaskTraits
+    {
+        static constexpr bool takesStopToken = std::is_invocable_v<F, std::stop_token, A...>; 
+        using Result = typename std::conditional_t<takesStopToken, std::invoke_result<F, std::stop_token, A...>, std::invoke_result<F, A...>>::type; 
+    };
+
+    class Task
+    {
+    public: 
+        Task() = default; 
+        Task(const Task&) = delete; //no copy constructor, we only want to move tasks. 
+        Task(Task&& donor) noexcept : m_executor{ std::move(donor.m_executor) }, m_PState{ std::move(donor.m_PState) }, m_queuedAt{ donor.m_queuedAt } {}
+        Task& operator=(const Task&) = delete; 
+        Task& operator=(Task&& rhs) noexcept
+        {
+            m_executor = std::move(rhs.m_executor); 
+            m_PState = std::move(rhs.m_PState); 
+            m_queuedAt = rhs.m_queuedAt; 
+            return *this; 
+        }
+
+        void operator()()
+        {
+            m_executor(); 
+        }
+        operator bool() const
+        {
+            return (bool)m_executor; 
+        }
+
+        //Cancels the promise behind this task, if it has one. Running a cancelled task is a no-op. 
+        void Cancel()
+        {
+            if (m_PState)
+            {
+                m_PState->Cancel(); 
+            }
+        }
+
+        bool HasStopToken() const
+        {
+            return m_PState && m_PState->HasStopToken(); 
+        }
+
+        //Only stamped when the pool collects metrics and samples this task, for the queue wait histogram. Left at the default otherwise. 
+        void MarkQueued()
+        {
+            m_queuedAt = std::chrono::steady_clock::now(); 
+        }
+
+        std::chrono::steady_clock::time_point GetQueuedAt() const
+        {
+            return m_queuedAt; 
+        }
+
+        template<typename F, typename...A>
+        static auto Make(F&& function, A&&... arguments) //Make a task. 
+        {
+            Promise<typename TaskTraits<F, A...>::Result> promise; 
+            auto future = promise.GetFuture(); 
+            return std::make_pair(
+                Task{ std::forward<F>(function), std::move(promise), std::forward<A>(arguments)... },
+                std::move(future)
+            ); 
+        }
+
+        template<typename F>
+        static Task MakeDetached(F&& function) //Make a task without a promise, for fire and forget work nobody waits on. 
+        {
+            Task task; 
+            task.m_executor = std::forward<F>(function); 
+            return task; 
+        }
+
+    private: 
+        template<typename F, typename P, typename...A>
+        Task(F&& function, P&& promise, A&&... arguments) : m_PState{ promise.GetState() }
+        {
+            using Traits = TaskTraits<F, A...>; 
+            std::stop_token stopToken; 
+            if constexpr (Traits::takesStopToken)
+            {
+                stopToken = promise.GetStopToken(); 
+            }
+
+            m_executor =
+                //Capture this
+                [
+                    function = std::forward<F>(function),
+                    promise = std::forward<P>(promise),
+                    stopToken = std::move(stopToken),
+                    ...arguments = std::forward<A>(arguments) //captures parameter pack
+                ]() mutable
+            {
+                if (promise.IsCancelled())
+                {
+                    return; //Nobody is waiting for this anymore, don't burn the CPU on it. 
+                }
+
+                const auto invoke = [&]() -> decltype(auto)
+                {
+                    if constexpr (Traits::takesStopToken)
+                    {
+                        return function(stopToken, std::forward<A>(arguments)...); 
+                    }
+                    else
+                    {
+                        return function(std::forward<A>(arguments)...); 
+                    }
+                };
+
+                //A try block is free until something actually throws, so tasks that don't throw pay nothing for this. 
+                try
+                {
+                    if constexpr (std::is_void_v<typename Traits::Result>)
+                    {
+                        invoke(); 
+                        promise.Set(); 
+                    }
+                    else
+                    {
+                        promise.Set(invoke());
+                    }
+                }
+                catch (...)
+                {
+                    promise.SetException(std::current_exception()); 
+                }
+            };
+        }
+        std::function<void()> m_executor; 
+        std::shared_ptr<SharedStateBase> m_PState; //Only set for tasks that have a promise. 
+        std::chrono::steady_clock::time_point m_queuedAt; 
+    };
+
+    //What happens to queued work when a ThreadPool shuts down. 
+    enum class ShutdownMode
+    {
+        Drain, //Workers finish everything that is queued, including tasks queued by running tasks. 
+        Cancel //Queued tasks are cancelled and running tasks are asked to stop through their stop_token. 
+    };
+
+    //Tasks run with the same key prefer the same worker, so whatever they touch is still in that worker's caches. 
+    //A distinct type, so a key can't be mistaken for the callable of the plain Run. 
+    struct AffinityKey
+    {
+        size_t value; 
+    };
+
+    //A worker only gives up tasks queued for it to idle peers once this many are waiting, below that it'll get to them soon enough itself. 
+    inline constexpr size_t AffinityStealThreshold = 2; 
+
+    //Lock guards all the queues and the idle list, anything from Locks.h or std::mutex. Everything else uses it as ThreadPool, with the lock from Globals.h. 
+    template<typename Lock = DefaultLock>
+    class BasicThreadPool
+    {
+    public: 
+        //With useFibers every task runs on a fiber of its worker, and a Future::Get that would block parks just the fiber, so the worker 
+        //gets on with other tasks meanwhile. Anything else that blocks, a mutex, a sleep, a read, still blocks the whole worker. 
+        BasicThreadPool(size_t numWorkers, ShutdownMode shutdownMode = ShutdownMode::Drain, bool collectMetrics = PoolMetricsEnabled, bool useFibers = PoolFibersEnabled) 
+            : m_queues(numWorkers), m_shutdownMode{ shutdownMode }, m_useFibers{ useFibers }
+        {
+            if (collectMetrics)
+            {
+                m_metrics.emplace(numWorkers); 
+            }
+            std::latch countersOpened{ PerfCountersEnabled ? std::ptrdiff_t(numWorkers) : 0 }; 
+            m_workers.reserve(numWorkers); 
+            for (size_t i = 0; i < numWorkers; i++)
+            {
+                m_workers.emplace_back(this, i, &countersOpened); 
+            }
+            countersOpened.wait(); //So ReadPerfCounters never sees a worker still opening its group. 
+        }
+        template<typename F, typename...A> 
+        auto Run(F&& function, A&&... args)
+        {
+            auto [task, future] = Task::Make(std::forward<F>(function), std::forward<A>(args)...); 
+            Push_(std::move(task)); 
+            return future; 
+        }
+
+        //Same key, same worker, as long as it isn't backed up. Keys are spread over the workers round robin, so consecutive chunk indices make good keys. 
+        template<typename F, typename...A> 
+        auto Run(AffinityKey key, F&& function, A&&... args)
+        {
+            return RunOn(WorkerFor(key), std::forward<F>(function), std::forward<A>(args)...); 
+        }
+
+        //Queues the task for one worker. Idle workers can still steal it once that worker has AffinityStealThreshold tasks waiting. 
+        template<typename F, typename...A> 
+        auto RunOn(size_t worker, F&& function, A&&... args)
+        {
+            auto [task, future] = Task::Make(std::forward<F>(function), std::forward<A>(args)...); 
+            PushTo_(worker % m_queues.size(), std::move(task)); 
+            return future; 
+        }
+
+        size_t WorkerFor(AffinityKey key) const
+        {
+            return key.value % m_queues.size(); 
+        }
+
+        //Which of this pool's workers the calling thread is, empty on any other thread. 
+        std::optional<size_t> CurrentWorker() const
+        {
+            if (t_currentPool != this) return std::nullopt; 
+            return t_currentWorker; 
+        }
+
+        //Submits work without a promise/future pair, so small callables don't allocate any shared state. 
+        template<typename F>
+        void Post(F&& function)
+        {
+            Push_(Task::MakeDetached(std::forward<F>(function))); 
+        }
+
+        //Like Run, but the task only goes into the queue once it's due, so nothing sits on a worker sleeping. See TimerTick for how late it can be. 
+        template<typename F, typename...A> 
+        auto RunAt(std::chrono::steady_clock::time_point time, F&& function, A&&... args)
+        {
+            auto [task, future] = Task::Make(std::forward<F>(function), std::forward<A>(args)...); 
+            TimedTask timed; 
+            timed.task = std::move(task); 
+            TimerThread<TimedTask>* timers = Timers_(); 
+            if (!timers || !timers->Schedule(time, std::move(timed)))
+            {
+                timed.task.Cancel(); //Pool is shutting down, same as Push_. 
+            }
+            return future; 
+        }
+
+        template<typename F, typename...A> 
+        auto RunAfter(std::chrono::steady_clock::duration delay, F&& function, A&&... args)
+        {
+            return RunAt(std::chrono::steady_clock::now() + delay, std::forward<F>(function), std::forward<A>(args)...); 
+        }
+
+        //Queues the function every period, first one period from now, until the returned source is asked to stop. 
+        //Fixed rate, a late firing doesn't push the ones after it back. Runs can overlap if the function takes longer than the period. 
+        //A firing that throws stops it for good, so the returned source then reads as stopped, and counts in DetachedExceptions. 
+        template<typename F>
+        std::stop_source RunEvery(std::chrono::steady_clock::duration period, F&& function)
+        {
+            std::stop_source stop; 
+            TimedTask timed; 
+            timed.repeat = std::make_shared<std::function<void()>>(std::forward<F>(function)); 
+            timed.period = period; 
+            timed.due = std::chrono::steady_clock::now() + period; 
+            timed.stop = stop; 
+            TimerThread<TimedTask>* timers = Timers_(); 
+            if (!timers || !timers->Schedule(timed.due, std::move(timed)))
+            {
+                stop.request_stop(); //Pool is shutting down, it never fires. 
+            }
+            return stop; 
+        }
+
+        //With fibers, a parked fiber of this worker that's ready again comes out through resumed, with an empty task. A worker with live fibers 
+        //never gets the empty task that ends it, not even from a cancelling shutdown, they're running tasks that still have to finish. 
+        Task GetTask(std::stop_token& st, size_t worker, size_t liveFibers = 0, Fiber** resumed = nullptr)
+        {
+            //This is done among a single mutex. If something locks a mutex, it will be unavailable to all other things that have access to the mutex. 
+            Task task; 
+            {
+                std::unique_lock lk {m_taskQueueMtx}; 
+                auto& own = m_queues[worker]; 
+                const auto fiberReady = [&] { return resumed && !own.ready.empty(); }; 
+                while (!fiberReady() && (st.stop_requested() || !(task = TakeTask_(worker))) && (liveFibers > 0 || (!st.stop_requested() && m_state == State::Running)))
+                {
+                    //Every worker sleeps on its own condition variable, so a task queued for it wakes it and not some other worker. 
+                    own.idle = true; 
+                    m_idleWorkers.push_back(worker); 
+                    if (liveFibers > 0)
+                    {
+                        own.cv.wait(lk, [&own] {return !own.idle; }); //A stop doesn't end the waits of parked fibers, so it mustn't end this one either. 
+                    }
+                    else
+                    {
+                        own.cv.wait(lk, st, [&own] {return !own.idle; }); 
+                    }
+                    if (own.idle) //Woken by the stop token, nobody took us off the idle list. 
+                    {
+                        own.idle = false; 
+                        std::erase(m_idleWorkers, worker); 
+                    }
+                }
+                if (fiberReady())
+                {
+                    *resumed = own.ready.front(); 
+                    own.ready.pop_front(); 
+                    return task; 
+                }
+                if (task && --m_queuedCount == 0)
+                {
+                    m_AllDonecv.notify_all(); //Notify all the people waiting for this condition. 
+                }
+            }
+            if (m_metrics && task)
+            {
+                m_metrics->OnDequeued(worker, task.GetQueuedAt()); //Outside the lock, the clock read doesn't need it. 
+            }
+            return task; //We can check for empty task in the call. Empty while draining means the queue ran dry. 
+        }
+
+        void WaitForAllDone()
+        {
+            std::unique_lock lk {m_taskQueueMtx}; 
+            m_AllDonecv.wait(lk, [this] {return m_queuedCount == 0; }); //Block until every queue is empty.
+        }
+
+        //Counters of every worker thread since it started, empty without PerfCountersEnabled. The pool's chunk boundaries are its tasks,
+        //so diff two of these around whatever batch of tasks is interesting. Reading doesn't need the workers, so it costs them nothing. 
+        std::vector<PerfSample> ReadPerfCounters() const
+        {
+            std::vector<PerfSample> samples; 
+            samples.reserve(m_workers.size()); 
+            for (const auto& w : m_workers)
+            {
+                samples.push_back(w.ReadPerfCounters()); 
+            }
+            return samples; 
+        }
+
+        //The same counters, read from inside a task for the worker running it. Diff two around the part of the task that's interesting
+        //to get it on its own, which ReadPerfCounters can't, since from outside there's no telling when a worker moves on to the next task. 
+        //A read is a syscall, so it's up to the task, the workers never read between tasks themselves. Empty off this pool's workers. 
+        //On a fiber, whatever the worker runs while the task is parked in a Get counts too. 
+        PerfSample ReadTaskPerfCounters() const
+        {
+            if (t_currentPool != this) return {}; 
+            return m_workers[t_currentWorker].ReadPerfCounters(); 
+        }
+
+        //Queue depth, busy workers, completed tasks and queue wait times, all zero when the pool was made without metrics. 
+        //Lock free on both sides, a scrape never holds up the workers. The detached exception count is always there. 
+        PoolMetricsSnapshot ReadMetrics() const
+        {
+            PoolMetricsSnapshot snapshot = m_metrics ? m_metrics->Read() : PoolMetricsSnapshot{}; 
+            snapshot.detachedExceptions = DetachedExceptions(); 
+            return snapshot; 
+        }
+
+        //Exceptions thrown by Post tasks and RunEvery firings. Those have no future to carry them, so they're only counted. 
+        uint64_t DetachedExceptions() const
+        {
+            return m_detachedExceptions.load(std::memory_order_relaxed); 
+        }
+
+        //Stops the workers and blocks until they are joined. Futures of tasks that never ran report that they were cancelled. 
+        void Shutdown(ShutdownMode mode)
+        {
+            //Timers that aren't due yet aren't queued work, so even a drain cancels them. Has to happen first, the timer thread pushes tasks. 
+            //Taken under the lock Timers_ starts the thread under, so one can't start after this and never be stopped. 
+            TimerThread<TimedTask>* timers = nullptr; 
+            {
+                std::lock_guard lk {m_taskQueueMtx}; 
+                m_timersClosed = true; 
+                timers = m_timers.get(); 
+            }
+            if (timers)
+            {
+                timers->Stop([](TimedTask&& timed) { timed.task.Cancel(); }); //Not under the lock, its flush pushes. 
+            }
+
+            std::deque<Task> cancelled; 
+            {
+                std::lock_guard lk {m_taskQueueMtx}; 
+                if (m_state != State::Running) return; 
+                if (mode == ShutdownMode::Drain)
+                {
+                    m_state = State::Draining; 
+                }
+                else
+                {
+                    m_state = State::Stopped; 
+                    TakeAll_(cancelled); 
+                }
+                for (const size_t idle : m_idleWorkers)
+                {
+                    m_queues[idle].idle = false; 
+                }
+                m_idleWorkers.clear(); 
+            }
+            for (size_t i = 0; i < m_queues.size(); i++)
+            {
+                m_queues[i].cv.notify_all(); 
+            }
+            m_AllDonecv.notify_all(); 
+
+            for (auto& task : cancelled)
+            {
+                task.Cancel(); 
+            }
+            if (mode == ShutdownMode::Cancel)
+            {
+                for (auto& w : m_workers)
+                {
+                    w.RequestStop(); 
+                }
+            }
+            for (auto& w : m_workers)
+            {
+                w.Join(); 
+            }
+
+            //Anything that was pushed after the last worker left can't run anymore. 
+            {
+                std::lock_guard lk {m_taskQueueMtx}; 
+                m_state = State::Stopped; 
+                TakeAll_(cancelled); 
+            }
+            for (auto& task : cancelled)
+            {
+                task.Cancel(); 
+            }
+        }
+
+        ~BasicThreadPool()
+        {
+            Shutdown(m_shutdownMode); 
+        }
+
+    private: 
+        //A one shot task, or a periodic function with when it's due next. 
+        struct TimedTask
+        {
+            Task task; 
+            std::shared_ptr<std::function<void()>> repeat; 
+            std::chrono::steady_clock::duration period{}; 
+            std::chrono::steady_clock::time_point due; 
+            std::stop_source stop; //The one RunEvery returned, so a throwing firing can stop the timer it came from. 
+        };
+
+        //The timer thread only starts with the first timer, pools that never use one don't pay for it. Null if Shutdown came first. 
+        //A scheduled timer costs a queue lock more this way, but the only other thread that looks at m_timers is Shutdown. 
+        TimerThread<TimedTask>* Timers_()
+        {
+            std::lock_guard lk {m_taskQueueMtx}; 
+            if (!m_timers && !m_timersClosed)
+            {
+                const auto dispatch = [this](TimedTask& timed) -> std::optional<std::chrono::steady_clock::time_point> {
+                    if (!timed.repeat)
+                    {
+                        m_dueTasks.push_back(std::move(timed.task)); 
+                        return std::nullopt; 
+                    }
+                    if (timed.stop.stop_requested())
+                    {
+                        return std::nullopt; 
+                    }
+                    m_dueTasks.push_back(Task::MakeDetached([repeat = timed.repeat, stop = timed.stop]() mutable {
+                        try
+                        {
+                            (*repeat)(); 
+                        }
+                        catch (...)
+                        {
+                            stop.request_stop(); //Don't keep firing something that's broken. 
+                            throw; //On to the worker, which counts it. 
+                        }
+                    })); 
+                    timed.due += timed.period; 
+                    return timed.due; 
+                }; 
+                //Everything due on one tick goes into the queue under one lock. 
+                m_timers = std::make_unique<TimerThread<TimedTask>>(dispatch, [this] { PushBatch_(m_dueTasks); }); 
+            }
+            return m_timers.get(); 
+        }
+
+        enum class State
+        {
+            Running,
+            Draining,
+            Stopped
+        };
+
+        void Push_(Task task)
+        {
+            if (m_metrics && PoolMetrics::SampleSubmission())
+            {
+                task.MarkQueued(); //Before the lock, so the wait includes getting into the queue. 
+            }
+            std::optional<size_t> wake; 
+            {
+                std::lock_guard lk {m_taskQueueMtx};
+                if (m_state != State::Stopped)
+                {
+                    m_tasks.push_back(std::move(task));
+                    task = {}; 
+                    m_queuedCount++; 
+                    if (m_metrics) m_metrics->OnSubmitted(); //Under the lock, see OnSubmitted. 
+                    wake = TakeIdle_(); 
+                }
+            } //We want to release the mutex before notifying the condition variable. 
+            if (task)
+            {
+                task.Cancel(); //Pool is gone, so the future has to know nobody will ever run this. 
+                return; 
+            }
+            if (wake)
+            {
+                m_queues[*wake].cv.notify_one(); 
+            }
+        }
+
+        //Push_ into one worker's own queue. Wakes that worker if it's idle, or an idle thief once the queue is long enough to share. 
+        void PushTo_(size_t worker, Task task)
+        {
+            if (m_metrics && PoolMetrics::SampleSubmission())
+            {
+                task.MarkQueued(); 
+            }
+            std::optional<size_t> wake; 
+            {
+                std::lock_guard lk {m_taskQueueMtx};
+                if (m_state != State::Stopped)
+                {
+                    auto& queue = m_queues[worker]; 
+                    queue.tasks.push_back(std::move(task));
+                    task = {}; 
+                    m_queuedCount++; 
+                    if (m_metrics) m_metrics->OnSubmitted(); 
+                    if (queue.idle)
+                    {
+                        std::erase(m_idleWorkers, worker); 
+                        queue.idle = false; 
+                        wake = worker; 
+                    }
+                    else if (queue.tasks.size() >= AffinityStealThreshold)
+                    {
+                        wake = TakeIdle_(); 
+                    }
+                }
+            }
+            if (task)
+            {
+                task.Cancel(); 
+                return; 
+            }
+            if (wake)
+            {
+                m_queues[*wake].cv.notify_one(); 
+            }
+        }
+
+        //Under m_taskQueueMtx. The worker's own queue first, then the shared one, then the back of the longest queue of another worker, 
+        //if it's long enough to be worth taking from. While draining anything goes, its owner might be gone already. 
+        Task TakeTask_(size_t worker)
+        {
+            Task task; 
+            auto& own = m_queues[worker].tasks; 
+            if (!own.empty())
+            {
+                task = std::move(own.front()); 
+                own.pop_front(); 
+                return task; 
+            }
+            if (!m_tasks.empty())
+            {
+                task = std::move(m_tasks.front()); 
+                m_tasks.pop_front(); 
+                return task; 
+            }
+            size_t victim = worker; 
+            size_t longest = m_state == State::Running ? AffinityStealThreshold - 1 : 0; 
+            for (size_t i = 0; i < m_queues.size(); i++)
+            {
+                if (m_queues[i].tasks.size() > longest)
+                {
+                    longest = m_queues[i].tasks.size(); 
+                    victim = i; 
+                }
+            }
+            if (victim != worker)
+            {
+                auto& stolen = m_queues[victim].tasks; 
+                task = std::move(stolen.back()); //The owner works from the front, the tasks it'll get to last are the ones to take. 
+                stolen.pop_back(); 
+            }
+            return task; 
+        }
+
+        //Under m_taskQueueMtx. Takes a worker off the idle list, the caller notifies it once the lock is released. 
+        std::optional<size_t> TakeIdle_()
+        {
+            if (m_idleWorkers.empty()) return std::nullopt; 
+            const size_t worker = m_idleWorkers.back(); 
+            m_idleWorkers.pop_back(); 
+            m_queues[worker].idle = false; 
+            return worker; 
+        }
+
+        //A parked fiber's wait is over, it goes ahead of new tasks on its own worker. Fibers never move to another worker, 
+        //so thread_locals, and whatever the compiler cached of their addresses, stay right across a Get. 
+        void MakeReady_(size_t worker, Fiber& fiber)
+        {
+            std::lock_guard lk {m_taskQueueMtx};
+            auto& queue = m_queues[worker]; 
+            queue.ready.push_back(&fiber); 
+            if (queue.idle)
+            {
+                std::erase(m_idleWorkers, worker); 
+                queue.idle = false; 
+                //Under the lock for once. Whoever settled the state may be no friend of the pool's, and once the lock is released the fiber 
+                //can finish and the pool be destroyed. 
+                queue.cv.notify_one(); 
+            }
+        }
+
+        //Under m_taskQueueMtx. Everything queued anywhere, for cancelling. 
+        void TakeAll_(std::deque<Task>& taken)
+        {
+            if (m_metrics)
+            {
+                m_metrics->OnDiscarded(m_queuedCount); 
+            }
+            const auto take = [&taken](std::deque<Task>& queue) {
+                for (auto& task : queue)
+                {
+                    taken.push_back(std::move(task)); 
+                }
+                queue.clear(); 
+            }; 
+            take(m_tasks); 
+            for (size_t i = 0; i < m_queues.size(); i++)
+            {
+                take(m_queues[i].tasks); 
+            }
+            m_queuedCount = 0; 
+        }
+
+        //Push_ for many tasks at once, one lock and at most one wake-up per worker. Leaves tasks empty. 
+        void PushBatch_(std::vector<Task>& tasks)
+        {
+            if (tasks.empty()) return; 
+            if (m_metrics)
+            {
+                for (auto& task : tasks)
+                {
+                    if (PoolMetrics::SampleSubmission()) task.MarkQueued(); 
+                }
+            }
+            bool stopped; 
+            std::vector<size_t> wake; 
+            {
+                std::lock_guard lk {m_taskQueueMtx};
+                stopped = m_state == State::Stopped; 
+                if (!stopped)
+                {
+                    for (auto& task : tasks)
+                    {
+                        m_tasks.push_back(std::move(task));
+                    }
+                    m_queuedCount += tasks.size(); 
+                    if (m_metrics) m_metrics->OnSubmitted(tasks.size()); 
+                    while (wake.size() < tasks.size() && !m_idleWorkers.empty())
+                    {
+                        wake.push_back(*TakeIdle_()); 
+                    }
+                }
+            }
+            if (stopped)
+            {
+                for (auto& task : tasks)
+                {
+                    task.Cancel(); 
+                }
+            }
+            else
+            {
+                for (const size_t worker : wake)
+                {
+                    m_queues[worker].cv.notify_one(); 
+                }
+            }
+            tasks.clear(); 
+        }
+
+        class Worker final : public FiberScheduler
+        {
+        public:
+            Worker(BasicThreadPool* pool, size_t index, std::latch* countersOpened) : m_PPool{ pool }, m_index{ index }, m_thread(std::bind_front(&Worker::RunKernel, this, countersOpened))
+            {
+
+            }
+            void RequestStop()
+            {
+                m_thread.request_stop(); 
+            }
+            void Join()
+            {
+                if (m_thread.joinable())
+                {
+                    m_thread.join(); 
+                }
+            }
+            PerfSample ReadPerfCounters() const
+            {
+                return m_counters ? m_counters->Read() : PerfSample{}; 
+            }
+
+            void Park(FiberWaitList& list) override
+            {
+                FiberWaiter waiter; 
+                waiter.scheduler = this; 
+                waiter.fiber = m_running; 
+                if (!list.Push(waiter))
+                {
+                    return; //Settled in the meantime. 
+                }
+                if (m_PPool->m_metrics)
+                {
+                    m_PPool->m_metrics->OnSuspended(m_index); 
+                }
+                m_running->Suspend(); //Anyone can make it ready from now on, but only this thread resumes it, and not before it's switched away. 
+            }
+
+            void Resume(Fiber& fiber) override
+            {
+                m_PPool->MakeReady_(m_index, fiber); 
+            }
+
+        private:
+            //Runs one task after another for its worker. A task keeps its fiber until it's done, however often it parks on the way. 
+            struct TaskFiber : Fiber
+            {
+                TaskFiber(Worker* owner, std::stop_token stop) : Fiber{ &Main_ }, worker{ owner }, stopToken{ std::move(stop) }
+                {}
+
+                static void Main_(Fiber& self)
+                {
+                    auto& fiber = static_cast<TaskFiber&>(self); 
+                    for (;;)
+                    {
+                        fiber.worker->RunTask_(fiber.task, fiber.stopToken); 
+                        fiber.task = {}; 
+                        fiber.finished = true; 
+                        fiber.Suspend(); 
+                    }
+                }
+
+                Worker* worker; 
+                std::stop_token stopToken; 
+                Task task; 
+                bool finished = false; 
+            };
+
+            void RunKernel(std::latch* countersOpened, std::stop_token st) //Jthread thing
+            {
+                if constexpr (PerfCountersEnabled)
+                {
+                    m_counters.emplace(); //Has to be opened on this thread to count it. 
+                    countersOpened->count_down(); 
+                }
+                t_currentPool = m_PPool; 
+                t_currentWorker = m_index; 
+                auto& metrics = m_PPool->m_metrics; 
+                if (metrics)
+                {
+                    metrics->BindCurrentThread(m_index); 
+                }
+                if (m_PPool->m_useFibers)
+                {
+                    RunFibers_(st); 
+                    return; 
+                }
+                while (auto task = m_PPool->GetTask(st, m_index))
+                {
+                    RunTask_(task, st); 
+                }
+     
+            }
+
+            void RunTask_(Task& task, std::stop_token& st)
+            {
+                auto& metrics = m_PPool->m_metrics; 
+                if (metrics)
+                {
+                    metrics->OnStarted(m_index); 
+                }
+                try
+                {
+                    if (task.HasStopToken())
+                    {
+                        //Forward a cancelling shutdown to the task that is running right now. 
+                        std::stop_callback onStop{ st, [&task] { task.Cancel(); } }; 
+                        task(); 
+                    }
+                    else
+                    {
+                        task(); 
+                    }
+                }
+                catch (...)
+                {
+                    //Tasks with a promise never get here. A throwing fire and forget task has nobody to report to, but it mustn't take the worker down. 
+                    //On a fiber this catch is also what keeps an exception from unwinding off the end of the fiber's stack. 
+                    m_PPool->m_detachedExceptions.fetch_add(1, std::memory_order_relaxed); 
+                }
+                if (metrics)
+                {
+                    metrics->OnFinished(m_index); 
+                }
+            }
+
+            //Fibers are made as needed and kept for the worker's lifetime, so after warming up starting a task is a switch, not an allocation. 
+            void RunFibers_(std::stop_token& st)
+            {
+                FiberHost host; 
+                std::vector<std::unique_ptr<TaskFiber>> fibers; 
+                std::vector<TaskFiber*> spare; 
+                size_t live = 0; //Running a task, parked, or ready to go on. 
+                auto& metrics = m_PPool->m_metrics; 
+                for (;;)
+                {
+                    Fiber* resumed = nullptr; 
+                    Task task = m_PPool->GetTask(st, m_index, live, &resumed); 
+                    TaskFiber* fiber = static_cast<TaskFiber*>(resumed); //Only this worker's fibers are ever made ready on it. 
+                    if (fiber)
+                    {
+                        if (metrics)
+                        {
+                            metrics->OnResumed(m_index); 
+                        }
+                    }
+                    else
+                    {
+                        if (!task) break; 
+                        if (spare.empty())
+                        {
+                            fibers.push_back(std::make_unique<TaskFiber>(this, st)); 
+                            spare.push_back(fibers.back().get()); 
+                        }
+                        fiber = spare.back(); 
+                        spare.pop_back(); 
+                        fiber->task = std::move(task); 
+                        fiber->finished = false; 
+                        live++; 
+                    }
+
+                    m_running = fiber; 
+                    SetCurrent_(this); 
+                    fiber->Resume(); 
+                    SetCurrent_(nullptr); 
+                    if (fiber->finished)
+                    {
+                        live--; 
+                        spare.push_back(fiber); 
+                    }
+                }
+            }
+            BasicThreadPool* m_PPool; 
+            size_t m_index; 
+            std::optional<PerfCounters> m_counters; 
+            TaskFiber* m_running = nullptr; //Only meaningful while a fiber runs. 
+            std::jthread m_thread;
+        };
+
+        //What a worker sleeps on, and the tasks queued for it in particular. All of it guarded by m_taskQueueMtx. 
+        struct WorkerQueue
+        {
+            std::deque<Task> tasks; 
+            std::deque<Fiber*> ready; //Parked fibers that can go on, never stolen. 
+            std::condition_variable_any cv; 
+            bool idle = false; //Waiting in GetTask and on m_idleWorkers. 
+        };
+
+        static inline thread_local const BasicThreadPool* t_currentPool = nullptr; 
+        static inline thread_local size_t t_currentWorker = 0; 
+
+        //Data
+        Lock m_taskQueueMtx; 
+        std::condition_variable_any m_AllDonecv;
+        std::deque<Task> m_tasks; //Tasks any worker can take. 
+        std::vector<WorkerQueue> m_queues; //Sized once up front, the workers go by its size since m_workers is still filling up as they start. 
+        std::vector<size_t> m_idleWorkers; 
+        size_t m_queuedCount = 0; //Across m_tasks and every worker queue. 
+        State m_state = State::Running; 
+        ShutdownMode m_shutdownMode; 
+        bool m_useFibers; 
+        std::optional<PoolMetrics> m_metrics; //Before the workers, they use it until they're joined. 
+        std::atomic<uint64_t> m_detachedExceptions = 0; 
+        std::vector<Worker> m_workers; 
+        bool m_timersClosed = false; //Under m_taskQueueMtx like m_timers, set by Shutdown. 
+        std::vector<Task> m_dueTasks; //Only the timer thread touches this. 
+        std::unique_ptr<TimerThread<TimedTask>> m_timers; //After the workers, so it's destroyed first, though Shutdown has stopped it by then. 
+
+    };
+
+    using ThreadPool = BasicThreadPool<>; 
+}
\ No newline at end of file
@@ -0,0 +1,617 @@
+#pragma once
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <latch>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <thread>
+#include <stdexcept>
+#include <vector>
+#include "Globals.h"
+#include "Locks.h"
+#include "Queued.h"
+#include "ThreadPool.h"
+#include "PoolMetrics.h"
+#include "PerfCounters.h"
+#include "Task.h"
+#include "Timer.h"
+
+namespace tk
+{
+	//Round trips small tasks through Run and Future::Get. The non throwing run is the fast path every task takes,
+	//the throwing run shows what transporting an exception through the shared state costs on top of that.
+	//The baseline Posts the same callable with no promise, try block or SetException, so the difference is what Run adds to a task.
+	int DoExceptionBenchmark()
+	{
+		constexpr size_t taskCount = 200000;
+
+		ThreadPool pool(WORKER_COUNT);
+		std::vector<Future<size_t>> futures;
+		futures.reserve(taskCount);
+
+		const auto baseline = [&](auto&& function)
+		{
+			std::vector<size_t> results(taskCount);
+			std::latch done{ ptrdiff_t(taskCount) };
+			Timer timer;
+			timer.StartTimer();
+			for (size_t i = 0; i < taskCount; i++)
+			{
+				pool.Post([&function, &results, &done, i] {
+					results[i] = function(i);
+					done.count_down();
+					});
+			}
+			done.wait();
+			const float timeElapsed = timer.GetTime();
+			const size_t sum = std::accumulate(results.begin(), results.end(), size_t(0));
+			printf("baseline, bare Post: %f microseconds, %f nanoseconds per task (sum %zu) \n", timeElapsed, timeElapsed * 1000.f / taskCount, sum);
+			return timeElapsed;
+		};
+
+		const auto measure = [&](auto&& function, const char* name)
+		{
+			futures.clear();
+			Timer timer;
+			timer.StartTimer();
+			for (size_t i = 0; i < taskCount; i++)
+			{
+				futures.push_back(pool.Run(function, i));
+			}
+
+			size_t sum = 0;
+			size_t caught = 0;
+			for (auto& future : futures)
+			{
+				try
+				{
+					sum += future.Get();
+				}
+				catch (const std::runtime_error&)
+				{
+					caught++;
+				}
+			}
+			const float timeElapsed = timer.GetTime();
+			printf("%s: %f microseconds, %f nanoseconds per task (sum %zu, caught %zu) \n", name, timeElapsed, timeElapsed * 1000.f / taskCount, sum, caught);
+			return timeElapsed;
+		};
+
+		const auto identity = [](size_t i) { return i; };
+		baseline(identity); //Warm up.
+		const float bare = baseline(identity);
+		const float run = measure(identity, "no exceptions");
+		printf("Run and Get add %f nanoseconds per task over the bare Post \n", (run - bare) * 1000.f / taskCount);
+		measure([](size_t i) -> size_t { throw std::runtime_error{ "task failed" }; return i; }, "every task throws");
+		measure([](size_t i) -> size_t { if (i % 100 == 0) throw std::runtime_error{ "task failed" }; return i; }, "1% of tasks throw");
+
+		//Posted tasks have nobody to hand an exception to, the pool only counts them.
+		for (size_t i = 0; i < taskCount / 100; i++)
+		{
+			pool.Post([] { throw std::runtime_error{ "task failed" }; });
+		}
+		pool.Shutdown(ShutdownMode::Drain); //Joins the workers, WaitForAllDone only waits for the queues to empty.
+		printf("%zu posted tasks threw, the pool counted %llu \n", taskCount / 100, (unsigned long long)pool.DetachedExceptions());
+		return 0;
+	}
+
+	//Promise to future latency. Set before get is the case where Get should be nothing more than a load,
+	//get before set measures how long a blocked Get takes to wake up after Set on another thread.
+	int DoFutureLatencyBenchmark()
+	{
+		using Clock = std::chrono::steady_clock;
+		constexpr size_t iterations = 100000;
+		constexpr size_t wakeups = 2000;
+
+		{
+			std::vector<Promise<size_t>> promises(iterations);
+			std::vector<Future<size_t>> futures;
+			futures.reserve(iterations);
+			for (auto& promise : promises)
+			{
+				futures.push_back(promise.GetFuture());
+			}
+			for (size_t i = 0; i < iterations; i++)
+			{
+				promises[i].Set(i);
+			}
+
+			size_t sum = 0;
+			const auto start = Clock::now();
+			for (auto& future : futures)
+			{
+				sum += future.Get();
+			}
+			const std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+			printf("set before get: %f nanoseconds per Get (sum %zu) \n", elapsed.count() / iterations, sum);
+		}
+
+		{
+			std::vector<double> latencies;
+			latencies.reserve(wakeups);
+			for (size_t i = 0; i < wakeups; i++)
+			{
+				Promise<Clock::time_point> promise;
+				auto future = promise.GetFuture();
+				std::atomic<bool> waiting = false;
+				double latency = 0.;
+				std::thread consumer{ [&] {
+					waiting = true;
+					const auto setTime = future.Get();
+					latency = std::chrono::duration<double, std::nano>(Clock::now() - setTime).count();
+				} };
+
+				//Give the consumer time to actually block in Get.
+				while (!waiting) std::this_thread::yield();
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+				promise.Set(Clock::now());
+				consumer.join();
+				latencies.push_back(latency);
+			}
+
+			std::ranges::sort(latencies);
+			printf("get before set: median %f, p99 %f, max %f nanoseconds from Set to Get returning \n",
+				latencies[wakeups / 2], latencies[wakeups * 99 / 100], latencies.back());
+		}
+		return 0;
+	}
+
+	//What the metrics cost the pool's hot path. Tiny fire and forget tasks go through a pool without and with metrics, best of a few runs each,
+	//and a scrape is timed on its own. The tasks do next to nothing, so this is the worst case. The runs take turns, so a noisy stretch of
+	//the machine hits both sides, and the spread between the two runs without metrics shows how much of the difference is noise.
+	int DoPoolMetricsBenchmark()
+	{
+		constexpr size_t taskCount = 500000;
+		constexpr size_t runs = 10;
+
+		const auto measure = [&](bool collectMetrics)
+		{
+			ThreadPool pool(WORKER_COUNT, ShutdownMode::Drain, collectMetrics);
+			std::atomic<size_t> done = 0;
+			Timer timer;
+			timer.StartTimer();
+			for (size_t i = 0; i < taskCount; i++)
+			{
+				pool.Post([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+			}
+			while (done.load(std::memory_order_relaxed) < taskCount) std::this_thread::yield();
+			return timer.GetTime() * 1000.f / taskCount;
+		};
+
+		std::array<float, 3> best; //Without, with, without again.
+		best.fill(std::numeric_limits<float>::max());
+		for (size_t run = 0; run < runs; run++)
+		{
+			best[0] = std::min(best[0], measure(false));
+			best[1] = std::min(best[1], measure(true));
+			best[2] = std::min(best[2], measure(false));
+		}
+		const float without = std::min(best[0], best[2]);
+		printf("without metrics: %f nanoseconds per task, the two interleaved series %+f%% apart \n", without, (std::max(best[0], best[2]) / without - 1.f) * 100.f);
+		printf("with metrics: %f nanoseconds per task (%+f%%) \n", best[1], (best[1] / without - 1.f) * 100.f);
+
+		//The same hooks a task goes through, on one thread with nothing else going on. What's left of the difference above is scheduling.
+		{
+			constexpr size_t hookRounds = 1000000;
+			PoolMetrics metrics{ WORKER_COUNT };
+			Timer timer;
+			timer.StartTimer();
+			for (size_t i = 0; i < hookRounds; i++)
+			{
+				const auto queuedAt = PoolMetrics::SampleSubmission() ? PoolMetrics::Clock::now() : PoolMetrics::Clock::time_point{};
+				metrics.OnSubmitted();
+				metrics.OnDequeued(0, queuedAt);
+				metrics.OnStarted(0);
+				metrics.OnFinished(0);
+			}
+			printf("hooks alone: %f nanoseconds per task (%llu counted) \n", timer.GetTime() * 1000.f / hookRounds, (unsigned long long)metrics.Read().completed);
+		}
+
+		ThreadPool pool(WORKER_COUNT, ShutdownMode::Drain, true);
+		for (size_t i = 0; i < 1000; i++)
+		{
+			pool.Post([] {});
+		}
+		pool.WaitForAllDone();
+		constexpr size_t scrapes = 10000;
+		size_t bytes = 0;
+		Timer timer;
+		timer.StartTimer();
+		for (size_t i = 0; i < scrapes; i++)
+		{
+			bytes += ToPrometheusText(pool.ReadMetrics(), "main").size();
+		}
+		printf("scrape: %f microseconds (%zu bytes) \n", timer.GetTime() / scrapes, bytes / scrapes);
+		return 0;
+	}
+
+	//A million one shot timers spread over a few seconds, all scheduled before the first is due, and a 1ms periodic timer running while they're pending.
+	//Lateness is from the time a timer was due until its task started on a worker, so it includes the tick, the timer thread waking up and the queue.
+	int DoTimerBenchmark()
+	{
+		using Clock = std::chrono::steady_clock;
+		constexpr size_t timerCount = 1000000;
+		constexpr auto lead = std::chrono::seconds(1);
+		constexpr auto spread = std::chrono::seconds(4);
+		constexpr auto period = std::chrono::milliseconds(1);
+
+		const auto printLateness = [](const char* name, std::vector<float>& lateness)
+		{
+			std::ranges::sort(lateness);
+			printf("%s lateness: median %f, p99 %f, p99.9 %f, max %f microseconds \n", name,
+				lateness[lateness.size() / 2], lateness[lateness.size() * 99 / 100], lateness[lateness.size() * 999 / 1000], lateness.back());
+		};
+
+		ThreadPool pool(WORKER_COUNT);
+		std::vector<float> lateness(timerCount);
+		std::atomic<size_t> fired = 0;
+		std::mt19937 random{ DatasetSeed };
+		std::uniform_int_distribution<int64_t> offset{ 0, std::chrono::duration_cast<std::chrono::microseconds>(spread).count() };
+
+		const auto start = Clock::now() + lead;
+		Timer timer;
+		timer.StartTimer();
+		for (size_t i = 0; i < timerCount; i++)
+		{
+			const auto due = start + std::chrono::microseconds(offset(random));
+			pool.RunAt(due, [&lateness, &fired, i, due] {
+				lateness[i] = std::chrono::duration<float, std::micro>(Clock::now() - due).count();
+				fired.fetch_add(1, std::memory_order_relaxed);
+			});
+		}
+		const float scheduleTime = timer.GetTime();
+		printf("scheduled %zu timers in %f microseconds, %f nanoseconds per timer \n", timerCount, scheduleTime, scheduleTime * 1000.f / timerCount);
+
+		//Started once all of them are pending and the timer thread has taken them in, so it runs next to a million timers rather than next to the loop above.
+		std::this_thread::sleep_until(start - lead / 2);
+		std::vector<float> periodicLateness(std::chrono::duration_cast<std::chrono::milliseconds>(lead + spread * 2).count());
+		std::atomic<size_t> periodicFired = 0;
+		const auto periodicStart = Clock::now();
+		auto periodic = pool.RunEvery(period, [&] {
+			const size_t n = periodicFired.fetch_add(1, std::memory_order_relaxed);
+			if (n < periodicLateness.size())
+			{
+				periodicLateness[n] = std::chrono::duration<float, std::micro>(Clock::now() - (periodicStart + period * (n + 1))).count();
+			}
+		});
+
+		while (fired.load(std::memory_order_relaxed) < timerCount)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		const std::chrono::duration<float> firing = Clock::now() - start;
+		periodic.request_stop();
+		pool.Shutdown(ShutdownMode::Drain); //Firings already queued still run, and they write periodicLateness. Joined before it's read.
+		printf("fired %zu timers in %f seconds, %f per second \n", timerCount, firing.count(), timerCount / firing.count());
+		printLateness("one shot", lateness);
+
+		periodicLateness.resize(std::min(periodicLateness.size(), periodicFired.load()));
+		if (!periodicLateness.empty())
+		{
+			printLateness("1ms periodic", periodicLateness);
+		}
+		return 0;
+	}
+
+	//The same chunks processed round after round, each round's tasks through the shared queue and then with the chunk index as the affinity key.
+	//Twice as many chunks as workers, so a worker's share fits in its L2 but not every chunk does. The work per task is a pass over the chunk's
+	//memory, so where the chunk was last time is most of the cost. Counts the tasks that landed on the same worker as the round before,
+	//and L1D/LLC misses per task where the machine lets us count them.
+	int DoAffinityBenchmark()
+	{
+		constexpr size_t chunkCount = WORKER_COUNT * 2;
+		constexpr size_t rounds = 500;
+		constexpr size_t passes = 4;
+
+		std::vector<Chunk> chunks(chunkCount);
+		for (size_t c = 0; c < chunkCount; c++)
+		{
+			FillChunkRandom(chunks[c], c);
+		}
+
+		const auto measure = [&](const char* name, bool useAffinity)
+		{
+			ThreadPool pool(WORKER_COUNT);
+			std::mutex countersMtx;
+			std::vector<const PerfCounters*> counters; //One per worker thread, opened by its first task.
+			std::vector<size_t> lastWorker(chunkCount, SIZE_MAX);
+			size_t stayed = 0;
+			double sink = 0.;
+			std::vector<Future<std::pair<double, size_t>>> futures;
+			futures.reserve(chunkCount);
+
+			const auto work = [&](size_t c) {
+				thread_local std::optional<PerfCounters> t_counters;
+				if (!t_counters)
+				{
+					t_counters.emplace();
+					std::lock_guard lk{ countersMtx };
+					counters.push_back(&*t_counters);
+				}
+				double sum = 0.;
+				for (size_t pass = 0; pass < passes; pass++)
+				{
+					for (const auto& task : chunks[c])
+					{
+						sum += task.heavy ? task.val : -task.val;
+					}
+				}
+				return sum;
+			};
+			const auto runRound = [&] {
+				for (size_t c = 0; c < chunkCount; c++)
+				{
+					futures.push_back(useAffinity ? pool.Run(AffinityKey{ c }, [&, c] { return std::pair{ work(c), *pool.CurrentWorker() }; })
+						: pool.Run([&, c] { return std::pair{ work(c), *pool.CurrentWorker() }; }));
+				}
+				for (size_t c = 0; c < chunkCount; c++)
+				{
+					const auto [sum, worker] = futures[c].Get();
+					sink += sum;
+					stayed += worker == lastWorker[c] ? 1 : 0;
+					lastWorker[c] = worker;
+				}
+				futures.clear();
+			};
+			const auto readCounters = [&] {
+				PerfSample total;
+				total.availableMask = ~0u;
+				std::lock_guard lk{ countersMtx };
+				for (const auto* c : counters)
+				{
+					const auto sample = c->Read();
+					total.availableMask &= sample.availableMask;
+					for (size_t i = 0; i < PerfEventCount; i++)
+					{
+						total.values[i] += sample.values[i];
+					}
+				}
+				if (counters.empty()) total.availableMask = 0;
+				return total;
+			};
+
+			runRound(); //Warms up the caches and opens every worker's counters.
+			stayed = 0;
+			const auto before = readCounters();
+			Timer timer;
+			timer.StartTimer();
+			for (size_t round = 0; round < rounds; round++)
+			{
+				runRound();
+			}
+			const float timeElapsed = timer.GetTime();
+			const auto misses = readCounters() - before;
+
+			printf("%s: %f microseconds per round, %f%% of tasks on the same worker as last round", name, timeElapsed / rounds, 100. * double(stayed) / double(rounds * chunkCount));
+			for (const auto event : { PerfEvent::L1DMisses, PerfEvent::LLCMisses })
+			{
+				if (misses.Has(event))
+				{
+					printf(", %s %f per task", PerfEventNames[size_t(event)], double(misses[event]) / double(rounds * chunkCount));
+				}
+			}
+			printf(" (%f) \n", sink);
+		};
+
+		printf("%zu chunks of %zu KB, %zu workers \n", chunkCount, sizeof(Chunk) / 1024, WORKER_COUNT);
+		measure("shared queue", false);
+		measure("affinity", true);
+		return 0;
+	}
+
+	//What a blocking Get costs with fibers and without. First a bare switch into a fiber and back, then two tasks handing a turn back and forth
+	//through promises, which with threads is a futex wake and a context switch each way. Then lots of tasks waiting on slow I/O at the same time,
+	//with the I/O done by a timer thread setting promises: with threads every waiting task holds a worker, with fibers only a stack.
+	int DoFiberBenchmark()
+	{
+		using Clock = std::chrono::steady_clock;
+		constexpr size_t switches = 1000000;
+		constexpr size_t handOvers = 100000;
+		constexpr auto ioLatency = std::chrono::milliseconds(1);
+
+		{
+			FiberHost host;
+			Fiber fiber{ [](Fiber& self) {
+				for (;;)
+				{
+					self.Suspend();
+				}
+			} };
+			Timer timer;
+			timer.StartTimer();
+			for (size_t i = 0; i < switches; i++)
+			{
+				fiber.Resume();
+			}
+			printf("fiber switch: %f nanoseconds per resume and suspend \n", timer.GetTime() * 1000.f / switches);
+		}
+
+		const auto pingPong = [](const char* name, size_t workers, bool useFibers)
+		{
+			std::vector<Promise<void>> ping(handOvers);
+			std::vector<Promise<void>> pong(handOvers);
+			std::vector<Future<void>> pinged;
+			std::vector<Future<void>> ponged;
+			pinged.reserve(handOvers);
+			ponged.reserve(handOvers);
+			for (size_t i = 0; i < handOvers; i++)
+			{
+				pinged.push_back(ping[i].GetFuture());
+				ponged.push_back(pong[i].GetFuture());
+			}
+
+			ThreadPool pool(workers, ShutdownMode::Drain, PoolMetricsEnabled, useFibers);
+			Timer timer;
+			timer.StartTimer();
+			auto ponger = pool.Run([&] {
+				for (size_t i = 0; i < handOvers; i++)
+				{
+					pinged[i].Get();
+					pong[i].Set();
+				}
+			});
+			auto pinger = pool.Run([&] {
+				for (size_t i = 0; i < handOvers; i++)
+				{
+					ping[i].Set();
+					ponged[i].Get();
+				}
+			});
+			pinger.Get();
+			ponger.Get();
+			printf("%s: %f nanoseconds per hand over \n", name, timer.GetTime() * 1000.f / (handOvers * 2));
+		};
+		pingPong("ping pong, threads on 2 workers", 2, false);
+		pingPong("ping pong, fibers on 1 worker", 1, true);
+
+		const auto blockingIo = [ioLatency](size_t taskCount, bool useFibers)
+		{
+			std::vector<Promise<void>> io(taskCount);
+			TimerThread<Promise<void>*> device{ [](Promise<void>*& done) -> std::optional<Clock::time_point> {
+				done->Set();
+				return std::nullopt;
+			} };
+			std::atomic<size_t> waiting = 0;
+			std::atomic<size_t> mostWaiting = 0;
+
+			ThreadPool pool(WORKER_COUNT, ShutdownMode::Drain, PoolMetricsEnabled, useFibers);
+			std::vector<Future<size_t>> results;
+			results.reserve(taskCount);
+			Timer timer;
+			timer.StartTimer();
+			for (size_t i = 0; i < taskCount; i++)
+			{
+				results.push_back(pool.Run([&, i] {
+					auto done = io[i].GetFuture();
+					(void)device.Schedule(Clock::now() + ioLatency, &io[i]);
+					const size_t now = waiting.fetch_add(1, std::memory_order_relaxed) + 1;
+					size_t most = mostWaiting.load(std::memory_order_relaxed);
+					while (now > most && !mostWaiting.compare_exchange_weak(most, now, std::memory_order_relaxed)) {}
+					done.Get();
+					waiting.fetch_sub(1, std::memory_order_relaxed);
+					return i;
+				}));
+			}
+			size_t sum = 0;
+			for (auto& result : results)
+			{
+				sum += result.Get();
+			}
+			const float timeElapsed = timer.GetTime();
+			printf("%zu tasks waiting %lld us on I/O, %s: %f microseconds, %f tasks per second, at most %zu waiting at once (%zu) \n", taskCount,
+				(long long)std::chrono::duration_cast<std::chrono::microseconds>(ioLatency).count(), useFibers ? "fibers" : "threads",
+				timeElapsed, taskCount / (timeElapsed * 1e-6f), mostWaiting.load(), sum);
+		};
+		blockingIo(2000, false);
+		blockingIo(2000, true);
+		blockingIo(20000, true);
+		return 0;
+	}
+
+	//Every lock under contention on its own: threads take it, write a few shared cache lines inside, and do a little private work between
+	//acquisitions. Swept over thread count and how many lines the critical section writes, every cell for a fixed time, so a lock that
+	//collapses doesn't hold up the rest. Fairness is the fewest acquisitions any thread got over the most. Then the queued engine and
+	//a ThreadPool with each lock, to see how much of their cost is the lock.
+	int DoLockBenchmark()
+	{
+		using Clock = std::chrono::steady_clock;
+		constexpr auto cellTime = std::chrono::milliseconds(100);
+		constexpr size_t maxLines = 32;
+		constexpr size_t privateWork = 64;
+		constexpr size_t poolTasks = 200000;
+
+		struct alignas(64) Line
+		{
+			uint64_t value = 0;
+		};
+
+		for (const auto kind : AllLockKinds)
+		{
+			WithLock(kind, [&]<typename Lock>() {
+				for (const size_t threads : { 1, 2, 4, 8 })
+				{
+					for (const size_t lines : { 1, 4, 32 })
+					{
+						Lock lock;
+						std::array<Line, maxLines> shared{};
+						std::vector<uint64_t> acquisitions(threads);
+						std::vector<uint64_t> sinks(threads);
+						std::atomic<bool> stop = false;
+						std::latch started{ std::ptrdiff_t(threads) + 1 };
+						Clock::duration elapsed;
+						{
+							std::vector<std::jthread> workers;
+							for (size_t t = 0; t < threads; t++)
+							{
+								workers.emplace_back([&, t] {
+									uint64_t count = 0;
+									uint64_t privateValue = t;
+									started.arrive_and_wait();
+									while (!stop.load(std::memory_order_relaxed))
+									{
+										{
+											std::lock_guard lk{ lock };
+											for (size_t l = 0; l < lines; l++)
+											{
+												shared[l].value++;
+											}
+										}
+										count++;
+										for (size_t i = 0; i < privateWork; i++)
+										{
+											privateValue = privateValue * 6364136223846793005ull + 1442695040888963407ull;
+										}
+									}
+									acquisitions[t] = count;
+									sinks[t] = privateValue;
+								});
+							}
+							started.arrive_and_wait();
+							const auto start = Clock::now();
+							std::this_thread::sleep_for(cellTime);
+							stop.store(true, std::memory_order_relaxed);
+							workers.clear();
+							elapsed = Clock::now() - start;
+						}
+
+						const uint64_t total = std::accumulate(acquisitions.begin(), acquisitions.end(), uint64_t(0));
+						const auto [fewest, most] = std::ranges::minmax(acquisitions);
+						printf("%s, %zu threads, %zu lines in the lock: %f million per second, fairness %f%s (%llu) \n", LockName(kind), threads, lines,
+							double(total) / std::chrono::duration<double>(elapsed).count() * 1e-6, most ? double(fewest) / double(most) : 0.,
+							shared[0].value == total ? "" : ", LOST UPDATES", (unsigned long long)std::accumulate(sinks.begin(), sinks.end(), uint64_t(0)));
+					}
+				}
+			});
+		}
+
+		Dataset data = GenerateDatasetsRandom();
+		for (const auto kind : AllLockKinds)
+		{
+			WithLock(kind, [&]<typename Lock>() {
+				printf("queued, %s: ", LockName(kind));
+				queued::DoExperiment<Lock>(data.Chunks());
+
+				BasicThreadPool<Lock> pool(WORKER_COUNT);
+				std::atomic<size_t> ran = 0;
+				Timer timer;
+				timer.StartTimer();
+				for (size_t i = 0; i < poolTasks; i++)
+				{
+					pool.Post([&ran] { ran.fetch_add(1, std::memory_order_relaxed); });
+				}
+				while (ran.load(std::memory_order_relaxed) < poolTasks)
+				{
+					std::this_thread::yield(); //WaitForAllDone only waits for the queue to empty, the last tasks could still be running.
+				}
+				printf("ThreadPool, %s: %f nanoseconds per posted task (%zu) \n", LockName(kind), timer.GetTime() * 1000.f / poolTasks, ran.load());
+			});
+		}
+		return 0;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,341 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tk
+{
+	//How finely timers are told apart. A timer never fires early, and fires at most a tick late plus however long the wake-up takes.
+	inline constexpr std::chrono::microseconds TimerTick{ 100 };
+
+	//Hierarchical timer wheel, in the spirit of Varghese and Lauck. Level 0 has a slot per tick, every level above a slot per whole rotation of the one below,
+	//so 4 levels of 256 slots cover 2^32 ticks, about 5 days at 100us. Inserting is O(1), and an entry moves down a level at most 3 times before it fires.
+	//Entries sit in slots by the highest bits they differ from the current tick in, so everything on a level is ahead of the current slot of that level.
+	//Not thread safe, TimerThread owns one.
+	template<typename T>
+	class TimerWheel
+	{
+	public:
+		static constexpr size_t SlotBits = 8;
+		static constexpr size_t SlotCount = size_t(1) << SlotBits;
+		static constexpr size_t LevelCount = 4;
+		static constexpr uint64_t Span = uint64_t(1) << (SlotBits * LevelCount);
+
+		size_t Size() const
+		{
+			return m_size;
+		}
+
+		uint64_t Now() const
+		{
+			return m_now;
+		}
+
+		//Anything due now or in the past fires on the next tick.
+		void Insert(uint64_t deadline, T payload)
+		{
+			uint32_t node;
+			if (m_free != None)
+			{
+				node = m_free;
+				m_free = m_nodes[node].next;
+			}
+			else
+			{
+				node = uint32_t(m_nodes.size());
+				m_nodes.emplace_back();
+			}
+			m_nodes[node].deadline = deadline;
+			m_nodes[node].payload = std::move(payload);
+			m_size++;
+			Place_(node, m_now + 1);
+		}
+
+		//The next tick anything happens on, an entry firing or a slot moving down a level. Empty when the wheel is.
+		std::optional<uint64_t> NextEventTick() const
+		{
+			for (size_t level = 0; level < LevelCount; level++)
+			{
+				const size_t shift = SlotBits * level;
+				const size_t current = (m_now >> shift) & (SlotCount - 1);
+				if (const auto slot = NextOccupied_(level, current + 1))
+				{
+					const uint64_t block = m_now >> (shift + SlotBits) << (shift + SlotBits);
+					return block | (uint64_t(*slot) << shift);
+				}
+			}
+			if (m_overflow != None)
+			{
+				return (m_now / Span + 1) * Span;
+			}
+			return std::nullopt;
+		}
+
+		//Moves time forward to the given tick and hands every entry that came due to fire(T&&), in deadline order. fire may Insert.
+		template<typename F>
+		void Advance(uint64_t tick, F&& fire)
+		{
+			for (auto next = NextEventTick(); next && *next <= tick; next = NextEventTick())
+			{
+				m_now = *next; //Nothing happens on the ticks in between, so they're skipped.
+				Step_(fire);
+			}
+			m_now = std::max(m_now, tick);
+		}
+
+		//Empties the wheel without firing anything, e.g. to cancel what's left at shutdown.
+		template<typename F>
+		void Drain(F&& take)
+		{
+			for (auto& node : m_nodes)
+			{
+				if (node.live) take(std::move(node.payload));
+			}
+			*this = {};
+		}
+
+	private:
+		static constexpr uint32_t None = UINT32_MAX;
+
+		struct Node
+		{
+			uint64_t deadline = 0;
+			uint32_t next = None;
+			bool live = false;
+			T payload{};
+		};
+
+		//No sooner than minimum, which is the current tick only while moving entries down, since that slot is about to fire.
+		void Place_(uint32_t node, uint64_t minimum)
+		{
+			auto& entry = m_nodes[node];
+			entry.live = true;
+			const uint64_t deadline = std::max(entry.deadline, minimum);
+			const uint64_t differing = deadline ^ m_now;
+			const size_t level = differing == 0 ? 0 : size_t(std::bit_width(differing) - 1) / SlotBits;
+			if (level >= LevelCount)
+			{
+				entry.next = m_overflow; //Further out than the wheel reaches, looked at again once the top level wraps.
+				m_overflow = node;
+				return;
+			}
+			const size_t slot = (deadline >> (SlotBits * level)) & (SlotCount - 1);
+			entry.next = m_slots[level][slot];
+			m_slots[level][slot] = node;
+			m_occupied[level][slot / 64] |= uint64_t(1) << (slot % 64);
+		}
+
+		uint32_t Take_(size_t level, size_t slot)
+		{
+			m_occupied[level][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+			return std::exchange(m_slots[level][slot], None);
+		}
+
+		//First occupied slot at or after from on this level, without wrapping around.
+		std::optional<size_t> NextOccupied_(size_t level, size_t from) const
+		{
+			for (size_t word = from / 64; word < SlotCount / 64; word++)
+			{
+				uint64_t bits = m_occupied[level][word];
+				if (word == from / 64) bits &= ~uint64_t(0) << (from % 64);
+				if (bits) return word * 64 + size_t(std::countr_zero(bits));
+			}
+			return std::nullopt;
+		}
+
+		template<typename F>
+		void Step_(F& fire)
+		{
+			//Highest level first, so its entries can land in the lower slots that are moved down after it, down to the level 0 slot firing now.
+			if (m_now % Span == 0)
+			{
+				for (uint32_t node = std::exchange(m_overflow, None); node != None;)
+				{
+					const uint32_t next = m_nodes[node].next;
+					Place_(node, m_now);
+					node = next;
+				}
+			}
+			for (size_t level = LevelCount - 1; level > 0; level--)
+			{
+				const size_t shift = SlotBits * level;
+				if (m_now & ((uint64_t(1) << shift) - 1)) continue; //Not at the start of a slot of this level.
+				for (uint32_t node = Take_(level, (m_now >> shift) & (SlotCount - 1)); node != None;)
+				{
+					const uint32_t next = m_nodes[node].next;
+					Place_(node, m_now);
+					node = next;
+				}
+			}
+
+			for (uint32_t node = Take_(0, m_now & (SlotCount - 1)); node != None;)
+			{
+				auto& entry = m_nodes[node];
+				const uint32_t next = entry.next;
+				T payload = std::move(entry.payload);
+				entry.payload = T{};
+				entry.live = false;
+				entry.next = m_free;
+				m_free = node;
+				m_size--;
+				fire(std::move(payload)); //Might insert, which can reuse this node, so it's unlinked first.
+				node = next;
+			}
+		}
+
+		std::vector<Node> m_nodes; //Entries are indices into here, so a million timers are one allocation and a free list.
+		std::array<std::array<uint32_t, SlotCount>, LevelCount> m_slots = MakeEmptySlots_();
+		std::array<std::array<uint64_t, SlotCount / 64>, LevelCount> m_occupied{};
+		uint32_t m_overflow = None;
+		uint32_t m_free = None;
+		uint64_t m_now = 0;
+		size_t m_size = 0;
+
+		static constexpr std::array<std::array<uint32_t, SlotCount>, LevelCount> MakeEmptySlots_()
+		{
+			std::array<std::array<uint32_t, SlotCount>, LevelCount> slots{};
+			for (auto& level : slots)
+			{
+				level.fill(None);
+			}
+			return slots;
+		}
+	};
+
+	//One thread servicing a TimerWheel. Anyone can Schedule, the entries wait in an inbox until the thread picks them up, and the thread sleeps until
+	//the next tick anything is due on. A due entry goes to dispatch, which can hand back a time to re-arm it for. flush runs after every batch of them,
+	//so dispatch can just collect and hand them on in one go.
+	template<typename T>
+	class TimerThread
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+		using Dispatch = std::function<std::optional<Clock::time_point>(T&)>;
+		using Flush = std::function<void()>;
+
+		explicit TimerThread(Dispatch dispatch, Flush flush = {}) : m_dispatch{ std::move(dispatch) }, m_flush{ std::move(flush) }, m_thread{ std::bind_front(&TimerThread::Run_, this) }
+		{}
+
+		TimerThread(const TimerThread&) = delete;
+		TimerThread& operator=(const TimerThread&) = delete;
+
+		~TimerThread()
+		{
+			Stop([](T&&) {});
+		}
+
+		//False once the thread is stopped, the payload is left alone then.
+		bool Schedule(Clock::time_point time, T&& payload)
+		{
+			bool sooner;
+			{
+				std::lock_guard lk{ m_inboxMtx };
+				if (m_stopped) return false;
+				m_inbox.emplace_back(time, std::move(payload));
+				//Only worth waking the thread if it would sleep past this one, or there's a slice of them to put away, so they don't pile up until it wakes.
+				sooner = time < m_wakeAt || m_inbox.size() % InsertSlice == 0;
+			}
+			if (sooner)
+			{
+				m_cv.notify_one();
+			}
+			return true;
+		}
+
+		//Joins the thread and hands over everything that never fired.
+		template<typename F>
+		void Stop(F&& take)
+		{
+			{
+				std::lock_guard lk{ m_inboxMtx };
+				m_stopped = true;
+			}
+			m_thread.request_stop();
+			if (m_thread.joinable()) m_thread.join();
+			m_wheel.Drain(take);
+			for (auto& [time, payload] : m_inbox)
+			{
+				take(std::move(payload));
+			}
+			m_inbox.clear();
+		}
+
+	private:
+		//Compared before subtracting, time_point::max() for a timer that never fires or min() for one long overdue would overflow the duration.
+		uint64_t TickOf_(Clock::time_point time, bool roundUp) const
+		{
+			if (time <= m_epoch) return 0;
+			if (time >= TimeOf_(m_maxTick)) return m_maxTick;
+			const auto sinceEpoch = time - m_epoch;
+			const auto ticks = uint64_t(sinceEpoch / TimerTick);
+			return std::min(ticks + (roundUp && sinceEpoch % TimerTick != Clock::duration::zero() ? 1 : 0), m_maxTick);
+		}
+
+		Clock::time_point TimeOf_(uint64_t tick) const
+		{
+			return m_epoch + TimerTick * int64_t(std::min(tick, m_maxTick));
+		}
+
+		static constexpr size_t InsertSlice = 4096;
+
+		void Run_(std::stop_token st)
+		{
+			std::vector<std::pair<Clock::time_point, T>> arrived;
+			const auto fire = [this](T&& payload) {
+				if (const auto again = m_dispatch(payload))
+				{
+					m_wheel.Insert(TickOf_(*again, true), std::move(payload));
+				}
+			};
+			while (!st.stop_requested())
+			{
+				{
+					std::unique_lock lk{ m_inboxMtx };
+					const auto next = m_wheel.NextEventTick();
+					m_wakeAt = next ? TimeOf_(*next) : Clock::time_point::max();
+					m_cv.wait_until(lk, st, m_wakeAt, [this] { return !m_inbox.empty(); });
+					m_wakeAt = Clock::time_point::min(); //Awake, nobody needs to notify.
+					arrived.swap(m_inbox);
+				}
+				//A big burst of new timers is taken in slices, with whatever came due fired in between, so it doesn't hold up the ones already waiting.
+				size_t inserted = 0;
+				do
+				{
+					const size_t sliceEnd = std::min(arrived.size(), inserted + InsertSlice);
+					for (; inserted < sliceEnd; inserted++)
+					{
+						m_wheel.Insert(TickOf_(arrived[inserted].first, true), std::move(arrived[inserted].second));
+					}
+					m_wheel.Advance(TickOf_(Clock::now(), false), fire);
+					if (m_flush)
+					{
+						m_flush();
+					}
+				} while (inserted < arrived.size());
+				arrived.clear();
+			}
+		}
+
+		Dispatch m_dispatch;
+		Flush m_flush;
+		const Clock::time_point m_epoch = Clock::now();
+		const uint64_t m_maxTick = uint64_t((Clock::time_point::max() - m_epoch) / TimerTick); //The last tick a time point can still hold.
+		TimerWheel<T> m_wheel; //Only the timer thread touches this until it's joined.
+		std::mutex m_inboxMtx;
+		std::condition_variable_any m_cv;
+		std::vector<std::pair<Clock::time_point, T>> m_inbox;
+		Clock::time_point m_wakeAt = Clock::time_point::min();
+		bool m_stopped = false;
+		std::jthread m_thread; //Declared last, so everything Run_ touches is constructed before the thread starts.
+	};
+}
\ No newline at end of file
@@ -1,26 +1,57 @@
 #pragma once
+#include <algorithm>
 #include <array>
+#include <cstddef>
 #include <span>
+#include <string_view>
 #include <fstream>
-#include <format>
+#include <limits>
 #include "Globals.h"
+#include "PerfCounters.h"
 
 struct ChunkTimingInfo
 {
 	std::array<float, WORKER_COUNT> timeSpentWorkingPerThread;
 	std::array<size_t, WORKER_COUNT> numberOfHeavyItemsPerThread;
 	float totalChunkTime;
+	std::array<PerfSample, WORKER_COUNT> countersPerThread; //Only filled with PerfCountersEnabled.
+
+	//What an engine that picks its schedule per chunk decided, and how long it expected the chunk to take. Left empty by the fixed engines.
+	//The name is kept inline rather than as a pointer, since the multi process runs write these into shared memory for another process to read.
+	std::array<char, 16> schedule{};
+	size_t grain = 0;
+	float predictedChunkTime = 0.f;
+
+	void SetSchedule(std::string_view name)
+	{
+		schedule = {};
+		name.copy(schedule.data(), schedule.size() - 1);
+	}
+
+	bool HasSchedule() const
+	{
+		return schedule[0] != '\0';
+	}
 
 };
 
 void WriteCSV(const std::span<const ChunkTimingInfo> timings)
 {
 	std::ofstream csv{ "timings.csv", std::ios_base::trunc};
+	csv.precision(std::numeric_limits<double>::max_digits10); //Large microsecond counts would turn into 6 digit exponent notation otherwise.
 	for (size_t i = 0; i < WORKER_COUNT; i++)
 	{
-		csv << std::format("work_{0:};idle_{0:};heavy_{0:};", i);
+		csv << "work_" << i << ";idle_" << i << ";heavy_" << i << ';';
+		if constexpr (PerfCountersEnabled)
+		{
+			for (const auto name : PerfEventNames)
+			{
+				csv << name << '_' << i << ';';
+			}
+		}
 	}
-	csv << "chunktime,total_idle,total_heavy\n";
+	const bool hasDecisions = std::ranges::any_of(timings, [](const ChunkTimingInfo& chunk) { return chunk.HasSchedule(); });
+	csv << "chunktime;total_idle;total_heavy" << (hasDecisions ? ";schedule;grain;predicted_chunktime\n" : "\n");
 
 	for (const auto& chunk : timings)
 	{
@@ -31,10 +62,28 @@ void WriteCSV(const std::span<const ChunkTimingInfo> timings)
 			double idle = chunk.totalChunkTime - chunk.timeSpentWorkingPerThread[i];
 			double heavy = chunk.numberOfHeavyItemsPerThread[i];
 
-			csv << std::format("{};{};{};", chunk.timeSpentWorkingPerThread[i], idle, heavy);
+			csv << chunk.timeSpentWorkingPerThread[i] << ';' << idle << ';' << heavy << ';';
+			if constexpr (PerfCountersEnabled)
+			{
+				//Unavailable events stay empty, so they don't look like a zero count.
+				for (size_t e = 0; e < PerfEventCount; e++)
+				{
+					const auto& counters = chunk.countersPerThread[i];
+					if (counters.Has(PerfEvent(e)))
+					{
+						csv << counters.values[e];
+					}
+					csv << ';';
+				}
+			}
 			totalIdle += idle;
 			totalHeavy += heavy;
 		}
-		csv << std::format("{};{};{}\n", chunk.totalChunkTime, totalIdle, totalHeavy);
+		csv << chunk.totalChunkTime << ';' << totalIdle << ';' << totalHeavy;
+		if (hasDecisions)
+		{
+			csv << ';' << chunk.schedule.data() << ';' << chunk.grain << ';' << chunk.predictedChunkTime;
+		}
+		csv << '\n';
 	}
 }
\ No newline at end of file
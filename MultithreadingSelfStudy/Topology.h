@@ -0,0 +1,152 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//Which hardware threads share an L3 (or failing that, a NUMA node). Work split per group stays in one cache,
+//and a counter only those threads touch never has to leave it.
+struct CpuTopology
+{
+	std::vector<std::vector<unsigned>> groups;
+	const char* level = "none";
+
+	//Linux reads it from sysfs. Anywhere else, or if that isn't there, every hardware thread is one group.
+	static CpuTopology Detect()
+	{
+		CpuTopology topology;
+#ifdef __linux__
+		topology.groups = GroupByL3_(ParseCpuList_(ReadLine_("/sys/devices/system/cpu/online")));
+		if (!topology.groups.empty())
+		{
+			topology.level = "L3";
+		}
+		else
+		{
+			for (const unsigned node : ParseCpuList_(ReadLine_("/sys/devices/system/node/has_cpu"))) //Same list format, of nodes.
+			{
+				topology.groups.push_back(ParseCpuList_(ReadLine_("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist")));
+				topology.level = "NUMA node";
+			}
+			std::erase_if(topology.groups, [](const auto& cpus) { return cpus.empty(); });
+		}
+#endif
+		if (topology.groups.empty())
+		{
+			topology.groups.emplace_back();
+			for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++)
+			{
+				topology.groups.back().push_back(cpu);
+			}
+		}
+		std::ranges::sort(topology.groups, {}, [](const auto& cpus) { return cpus.front(); });
+		return topology;
+	}
+
+	size_t CpuCount() const
+	{
+		size_t count = 0;
+		for (const auto& cpus : groups)
+		{
+			count += cpus.size();
+		}
+		return count;
+	}
+
+	//Thread i goes on CpuOrder()[i % CpuCount()], filling one group before starting the next, so few threads share one cache.
+	std::vector<unsigned> CpuOrder() const
+	{
+		std::vector<unsigned> order;
+		for (const auto& cpus : groups)
+		{
+			order.insert(order.end(), cpus.begin(), cpus.end());
+		}
+		return order;
+	}
+
+	size_t GroupOf(unsigned cpu) const
+	{
+		for (size_t g = 0; g < groups.size(); g++)
+		{
+			if (std::ranges::find(groups[g], cpu) != groups[g].end()) return g;
+		}
+		return 0;
+	}
+
+	void Print() const
+	{
+		printf("%zu hardware threads in %zu %s group(s) \n", CpuCount(), groups.size(), level);
+	}
+
+private:
+#ifdef __linux__
+	static std::string ReadLine_(const std::string& path)
+	{
+		std::ifstream file{ path };
+		std::string line;
+		std::getline(file, line);
+		return line;
+	}
+
+	//Threads listing the same shared_cpu_list for their L3 share it. Empty if any of them doesn't say.
+	static std::vector<std::vector<unsigned>> GroupByL3_(const std::vector<unsigned>& online)
+	{
+		std::map<std::string, std::vector<unsigned>> byShared;
+		for (const unsigned cpu : online)
+		{
+			const auto shared = ReadLine_("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index3/shared_cpu_list");
+			if (shared.empty()) return {};
+			byShared[shared].push_back(cpu);
+		}
+		std::vector<std::vector<unsigned>> groups;
+		for (auto& [shared, cpus] : byShared)
+		{
+			groups.push_back(std::move(cpus));
+		}
+		return groups;
+	}
+
+	//"0-3,8-11" style lists.
+	static std::vector<unsigned> ParseCpuList_(const std::string& list)
+	{
+		std::vector<unsigned> cpus;
+		std::istringstream stream{ list };
+		std::string range;
+		while (std::getline(stream, range, ','))
+		{
+			unsigned first = 0;
+			unsigned last = 0;
+			const int read = sscanf(range.c_str(), "%u-%u", &first, &last);
+			if (read < 1) continue;
+			for (unsigned cpu = first; cpu <= (read == 2 ? last : first); cpu++)
+			{
+				cpus.push_back(cpu);
+			}
+		}
+		return cpus;
+	}
+#endif
+};
+
+//Best effort, a thread that can't be pinned just keeps running wherever the OS puts it.
+inline bool PinCurrentThread(unsigned cpu)
+{
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+	(void)cpu;
+	return false;
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,182 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "Globals.h"
+#include "Task.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+
+//After its first iteration Task::Process is a walk on a functional graph with only 100000 states (the sliced out digits).
+//This precomputes the successor of every state once, builds binary lifting tables on top of it (jump[j][s] = state after 2^j steps),
+//and from those the final result for every state at LIGHT_ITERATIONS and HEAVY_ITERATIONS. Processing a task is then one
+//Step for its own value plus one table load, with results identical to the scalar loop. Tasks with any other iteration count,
+//from the workloads in Workload.h, walk the jump tables instead, still only O(log iterations) loads.
+class TransitionTable
+{
+public:
+	static constexpr uint32_t StateCount = 100000;
+
+	explicit TransitionTable(tk::ThreadPool& pool)
+	{
+		const size_t levels = std::max<size_t>(1, std::bit_width(std::max({ LIGHT_ITERATIONS, HEAVY_ITERATIONS, MaxTaskIterations })));
+		m_jumps.resize(levels);
+
+		//Level 0 is the successor table itself.
+		m_jumps[0].resize(StateCount);
+		ParallelFor_(pool, [this](uint32_t s) { m_jumps[0][s] = Task::Step(double(s) / 10000.); });
+
+		for (size_t j = 1; j < levels; j++)
+		{
+			m_jumps[j].resize(StateCount);
+			const auto& prev = m_jumps[j - 1];
+			ParallelFor_(pool, [&, j](uint32_t s) { m_jumps[j][s] = prev[prev[s]]; });
+		}
+
+		m_lightResult.resize(StateCount);
+		m_heavyResult.resize(StateCount);
+		ParallelFor_(pool, [this](uint32_t s) {
+			m_lightResult[s] = ResultAfter_(s, LIGHT_ITERATIONS);
+			m_heavyResult[s] = ResultAfter_(s, HEAVY_ITERATIONS);
+			});
+	}
+
+	//Built on first use, so experiments should touch it before they start timing.
+	static const TransitionTable& Instance()
+	{
+		static const TransitionTable table = [] {
+			tk::ThreadPool pool(WORKER_COUNT);
+			return TransitionTable{ pool };
+		}();
+		return table;
+	}
+
+	//State after the given number of steps, in O(log steps) lookups.
+	uint32_t Advance(uint32_t state, size_t steps) const
+	{
+		for (size_t j = 0; steps != 0; j++, steps >>= 1)
+		{
+			if (steps & 1)
+			{
+				state = m_jumps[j][state];
+			}
+		}
+		return state;
+	}
+
+	unsigned int Process(const Task& task) const
+	{
+		if (task.iterations == 0 || task.iterations > MaxTaskIterations)
+		{
+			return task.Process();
+		}
+		//The first iteration still has to start from the task's own value, everything after that is in the table.
+		const uint32_t state = Task::Step(task.val);
+		if (task.iterations == LIGHT_ITERATIONS) return m_lightResult[state];
+		if (task.iterations == HEAVY_ITERATIONS) return m_heavyResult[state];
+		return ResultAfter_(state, task.iterations);
+	}
+
+private:
+	template<typename F>
+	static void ParallelFor_(tk::ThreadPool& pool, F&& function)
+	{
+		constexpr uint32_t blockSize = 4096;
+		std::vector<tk::Future<void>> futures;
+		futures.reserve(StateCount / blockSize + 1);
+		for (uint32_t begin = 0; begin < StateCount; begin += blockSize)
+		{
+			futures.push_back(pool.Run([&function, begin] {
+				const uint32_t end = std::min(begin + blockSize, StateCount);
+				for (uint32_t s = begin; s < end; s++)
+				{
+					function(s);
+				}
+				}));
+		}
+		for (auto& future : futures)
+		{
+			future.Get();
+		}
+	}
+
+	//Same expression as the tail of Task::Process, so the results match bit for bit.
+	unsigned int ResultAfter_(uint32_t firstState, size_t iterations) const
+	{
+		if (iterations == 0) return 0;
+		const double intermediate = double(Advance(firstState, iterations - 1)) / 10000.;
+		return static_cast<unsigned int>(std::exp(intermediate));
+	}
+
+	std::vector<std::vector<uint32_t>> m_jumps;
+	std::vector<unsigned int> m_lightResult;
+	std::vector<unsigned int> m_heavyResult;
+};
+
+//What the engines call per task, so the table mode is a setting in Globals.h instead of a change in every engine.
+inline unsigned int ProcessTask(const Task& task)
+{
+	if constexpr (UseTransitionTable)
+	{
+		return TransitionTable::Instance().Process(task);
+	}
+	else
+	{
+		return task.Process();
+	}
+}
+
+//Builds the table, checks it against the scalar loop for every task of a random dataset, and times both.
+int DoTransitionTableBenchmark()
+{
+	tk::ThreadPool pool(WORKER_COUNT);
+
+	Timer timer;
+	timer.StartTimer();
+	const TransitionTable table{ pool };
+	printf("Building the table: %f microseconds \n", timer.GetTime());
+
+	const Dataset data = GenerateDatasetsRandom(pool);
+
+	std::vector<unsigned int> expected;
+	expected.reserve(CHUNK_COUNT * CHUNK_SIZE);
+	timer.StartTimer();
+	for (const auto& chunk : data.Chunks())
+	{
+		for (const auto& task : chunk)
+		{
+			expected.push_back(task.Process());
+		}
+	}
+	const float scalarTime = timer.GetTime();
+
+	timer.StartTimer();
+	std::vector<unsigned int> results;
+	results.reserve(CHUNK_COUNT * CHUNK_SIZE);
+	for (const auto& chunk : data.Chunks())
+	{
+		for (const auto& task : chunk)
+		{
+			results.push_back(table.Process(task));
+		}
+	}
+	const float lookupTime = timer.GetTime();
+
+	size_t mismatches = 0;
+	unsigned int scalar = 0;
+	unsigned int lookup = 0;
+	for (size_t i = 0; i < expected.size(); i++)
+	{
+		mismatches += expected[i] != results[i] ? 1 : 0;
+		scalar += expected[i];
+		lookup += results[i];
+	}
+
+	printf("Scalar loop: %f microseconds, result %u \n", scalarTime, scalar);
+	printf("Transition table: %f microseconds, result %u \n", lookupTime, lookup);
+	printf("%zu mismatching tasks \n", mismatches);
+	return mismatches == 0 ? 0 : 1;
+}
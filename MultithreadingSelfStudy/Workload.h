@@ -0,0 +1,200 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <numbers>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include "Globals.h"
+#include "Task.h"
+#include "ThreadPool.h"
+#include "Timer.h"
+
+//Datasets where every task draws its own iteration count, for checking the engines against something closer to real costs than light and heavy.
+//They come out as ordinary Datasets, so every engine takes them as they are. Generated per chunk with ChunkRandom like the two class ones,
+//so they're the same whatever the thread count.
+namespace workload
+{
+	enum class Shape
+	{
+		Pareto, //Heavy tail, a few tasks are most of the work.
+		LogNormal, //Skewed, but no single task dominates.
+		Bimodal, //Light and heavy like the two class datasets, with some spread around both.
+		HotSpots, //Light everywhere except a few runs of neighbouring heavy tasks.
+		Drift, //Log normal with a mean that rises and falls from chunk to chunk.
+		Count
+	};
+
+	inline constexpr std::array<std::string_view, size_t(Shape::Count)> ShapeNames = { "pareto", "lognormal", "bimodal", "hotspots", "drift" };
+
+	inline std::optional<Shape> ShapeNamed(std::string_view name)
+	{
+		const auto found = std::ranges::find(ShapeNames, name);
+		if (found == ShapeNames.end()) return std::nullopt;
+		return Shape(found - ShapeNames.begin());
+	}
+
+	//Mean iterations per task of the two class datasets. The defaults below keep every shape close to it, so only how the work is spread differs.
+	inline constexpr double TwoClassMean = (1. - ProbabilityHeavy) * LIGHT_ITERATIONS + ProbabilityHeavy * HEAVY_ITERATIONS;
+
+	struct Params
+	{
+		Shape shape = Shape::Pareto;
+		double meanIterations = TwoClassMean; //Pareto, LogNormal and Drift. The cap at MaxTaskIterations takes a little off the Pareto one.
+		double paretoShape = 1.5; //Below 2 the variance is infinite, the closer to 1 the heavier the tail.
+		double logNormalSigma = 1.;
+		double bimodalSpread = .25; //Standard deviation of each mode, relative to its center.
+		size_t hotSpotWidth = 400;
+		size_t hotSpotsPerChunk = size_t(ProbabilityHeavy * CHUNK_SIZE / 400 + .5); //As many hot tasks as there are heavy ones in the two class datasets.
+		double driftAmplitude = .8; //The mean swings between (1 - amplitude) and (1 + amplitude) times meanIterations.
+		size_t driftPeriod = CHUNK_COUNT / 2; //In chunks, the chunk index stands in for time.
+	};
+
+	inline uint32_t ToIterations(double iterations)
+	{
+		return uint32_t(std::clamp(std::round(iterations), 1., double(MaxTaskIterations)));
+	}
+
+	inline void FillChunk(const Params& params, Chunk& chunk, size_t chunkIndex)
+	{
+		ChunkRandom random{ chunkIndex };
+		const auto val = [&] { return random.NextUnit() * 2. * std::numbers::pi; };
+		//Log normal with the given mean, mu is shifted down by sigma^2/2 since the mean of e^N(mu, sigma) is e^(mu + sigma^2/2).
+		const auto logNormal = [&](double mean) {
+			const double sigma = params.logNormalSigma;
+			return std::exp(std::log(mean) - sigma * sigma / 2. + sigma * random.NextNormal());
+		};
+
+		switch (params.shape)
+		{
+		case Shape::Pareto:
+		{
+			//Inverse transform, 1 - NextUnit() is in (0, 1]. The mean of a Pareto with scale m is alpha * m / (alpha - 1).
+			const double alpha = params.paretoShape;
+			const double scale = params.meanIterations * (alpha - 1.) / alpha;
+			std::ranges::generate(chunk, [&] {
+				const double v = val();
+				return Task::Make(v, ToIterations(scale / std::pow(1. - random.NextUnit(), 1. / alpha)));
+				});
+			break;
+		}
+		case Shape::LogNormal:
+			std::ranges::generate(chunk, [&] {
+				const double v = val();
+				return Task::Make(v, ToIterations(logNormal(params.meanIterations)));
+				});
+			break;
+		case Shape::Bimodal:
+			std::ranges::generate(chunk, [&] {
+				const double v = val();
+				const double center = double(random.NextUnit() < ProbabilityHeavy ? HEAVY_ITERATIONS : LIGHT_ITERATIONS);
+				return Task::Make(v, ToIterations(center * (1. + params.bimodalSpread * random.NextNormal())));
+				});
+			break;
+		case Shape::HotSpots:
+		{
+			std::ranges::generate(chunk, [&] { return Task::Make(val(), uint32_t(LIGHT_ITERATIONS)); });
+			//Spots can overlap, then the later one wins. Each is a bit hotter or colder than HEAVY_ITERATIONS, so they don't all look alike.
+			const size_t width = std::min(params.hotSpotWidth, CHUNK_SIZE);
+			for (size_t s = 0; s < params.hotSpotsPerChunk; s++)
+			{
+				const size_t begin = size_t(random.NextUnit() * double(CHUNK_SIZE - width + 1));
+				const uint32_t iterations = ToIterations(HEAVY_ITERATIONS * (.5 + random.NextUnit()));
+				for (size_t t = begin; t < begin + width; t++)
+				{
+					chunk[t] = Task::Make(chunk[t].val, iterations);
+				}
+			}
+			break;
+		}
+		case Shape::Drift:
+		{
+			const double phase = 2. * std::numbers::pi * double(chunkIndex) / double(std::max<size_t>(1, params.driftPeriod));
+			const double mean = params.meanIterations * (1. + params.driftAmplitude * std::sin(phase));
+			std::ranges::generate(chunk, [&] {
+				const double v = val();
+				return Task::Make(v, ToIterations(logNormal(mean)));
+				});
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	inline Dataset Generate(tk::ThreadPool& pool, const Params& params)
+	{
+		return GenerateChunksParallel(pool, [&params](Chunk& chunk, size_t chunkIndex) { FillChunk(params, chunk, chunkIndex); });
+	}
+
+	inline Dataset Generate(const Params& params)
+	{
+		tk::ThreadPool pool(WORKER_COUNT);
+		return Generate(pool, params);
+	}
+
+	//Generates every shape with the default parameters and prints how the work is spread: percentiles of the iteration counts, how much of the work
+	//the costliest 1% of tasks are, and how uneven the preassigned engine's subsets and the chunks come out. Run the engines on them with
+	//experiment <shape> <engine>, or all of them with engines.
+	inline int DoWorkloadBenchmark()
+	{
+		tk::ThreadPool pool(WORKER_COUNT);
+		for (size_t s = 0; s < size_t(Shape::Count); s++)
+		{
+			Timer timer;
+			timer.StartTimer();
+			const Dataset data = Generate(pool, { .shape = Shape(s) });
+			const float timeElapsed = timer.GetTime();
+
+			std::vector<uint32_t> iterations;
+			iterations.reserve(CHUNK_COUNT * CHUNK_SIZE);
+			std::vector<double> chunkWork;
+			chunkWork.reserve(CHUNK_COUNT);
+			double subsetImbalance = 0.;
+			size_t heavy = 0;
+			for (const auto& chunk : data.Chunks())
+			{
+				std::array<double, WORKER_COUNT> subsetWork{};
+				for (size_t t = 0; t < CHUNK_SIZE; t++)
+				{
+					iterations.push_back(chunk[t].iterations);
+					subsetWork[t / SUBSET_SIZE] += chunk[t].iterations;
+					heavy += chunk[t].heavy ? 1 : 0;
+				}
+				double work = 0.;
+				for (const double w : subsetWork)
+				{
+					work += w;
+				}
+				chunkWork.push_back(work);
+				subsetImbalance += *std::ranges::max_element(subsetWork) / (work / WORKER_COUNT); //Makespan of a static split over the ideal.
+			}
+			subsetImbalance /= double(CHUNK_COUNT);
+
+			std::ranges::sort(iterations);
+			double total = 0.;
+			for (const uint32_t i : iterations)
+			{
+				total += i;
+			}
+			const size_t count = iterations.size();
+			const auto percentile = [&](double p) { return iterations[std::min(count - 1, size_t(p * double(count)))]; };
+			double topWork = 0.;
+			for (size_t i = count - count / 100; i < count; i++)
+			{
+				topWork += iterations[i];
+			}
+			const double chunkMean = total / double(CHUNK_COUNT);
+
+			printf("%.*s: generated in %f microseconds, mean %f iterations, p50 %u, p99 %u, p99.9 %u, max %u, %zu heavy \n",
+				int(ShapeNames[s].size()), ShapeNames[s].data(), timeElapsed, total / double(count), percentile(.5), percentile(.99), percentile(.999),
+				iterations.back(), heavy);
+			printf("    top 1%% of tasks do %f%% of the work, static split makespan %f times ideal, costliest chunk %f times the mean \n",
+				100. * topWork / total, subsetImbalance, *std::ranges::max_element(chunkWork) / chunkMean);
+		}
+		return 0;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+#!/bin/sh
+#Builds every variant from CMakeLists.txt plus the two stage PGO build, runs the experiment on each dataset with each of them
+#and prints a table of median runtimes against the plain build.
+#  BUILD_DIR  where the variants go (default build), the PGO build lands in $BUILD_DIR-pgo
+#  RUNS       runs per variant and dataset, the median is reported (default 3)
+#  ENGINE     preassigned, queued, atomicqueued, hybrid or adaptive (default atomicqueued)
+#  DATASETS   which datasets to time (default "stacked evenly random")
+#  SKIP_BUILD set to 1 to only rerun the measurements
+set -eu
+
+cd "$(dirname "$0")"
+BUILD_DIR=${BUILD_DIR:-build}
+PGO_DIR=${BUILD_DIR}-pgo
+RUNS=${RUNS:-3}
+ENGINE=${ENGINE:-atomicqueued}
+DATASETS=${DATASETS:-stacked evenly random}
+JOBS=$(nproc 2>/dev/null || echo 2)
+
+if [ "${SKIP_BUILD:-0}" != 1 ]; then
+	cmake -S . -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release
+	cmake --build "$BUILD_DIR" -j "$JOBS"
+
+	#Stage one builds with instrumentation and trains, stage two rebuilds the same target with the profile.
+	cmake -S . -B "$PGO_DIR" -DCMAKE_BUILD_TYPE=Release -DMTSS_PGO=GENERATE
+	cmake --build "$PGO_DIR" -j "$JOBS"
+	cmake --build "$PGO_DIR" --target pgo-train
+	cmake -S . -B "$PGO_DIR" -DMTSS_PGO=USE
+	cmake --build "$PGO_DIR" -j "$JOBS"
+fi
+
+#Prints the median of the experiment's own timing over RUNS runs, or nothing if the binary can't run here
+#(x86-64-v4 on a machine without AVX-512 dies on the first illegal instruction).
+median_time()
+{
+	i=0
+	times=""
+	while [ "$i" -lt "$RUNS" ]; do
+		out=$("$1" experiment "$2" "$ENGINE" 2>/dev/null) || return 0
+		times="$times $(printf '%s\n' "$out" | awk '/microseconds/ { print $1; exit }')"
+		i=$((i + 1))
+	done
+	printf '%s\n' $times | sort -n | awk '{ t[NR] = $1 } END { print t[int((NR + 1) / 2)] }'
+}
+
+printf '%-34s' "variant"
+for dataset in $DATASETS; do
+	printf '%26s' "$dataset"
+done
+printf '\n'
+
+base_times=""
+for variant in MultithreadingSelfStudy MultithreadingSelfStudy_native MultithreadingSelfStudy_x86-64-v3 MultithreadingSelfStudy_x86-64-v4 MultithreadingSelfStudy_lto pgo; do
+	if [ "$variant" = pgo ]; then
+		binary="$PGO_DIR/MultithreadingSelfStudy"
+		name=MultithreadingSelfStudy_pgo
+	else
+		binary="$BUILD_DIR/$variant"
+		name=$variant
+	fi
+	[ -x "$binary" ] || continue
+
+	printf '%-34s' "$name"
+	column=0
+	for dataset in $DATASETS; do
+		column=$((column + 1))
+		t=$(median_time "$binary" "$dataset")
+		if [ -z "$t" ]; then
+			printf '%26s' "can't run here"
+			continue
+		fi
+		if [ "$variant" = MultithreadingSelfStudy ]; then
+			base_times="$base_times $t"
+		fi
+		base=$(printf '%s\n' $base_times | sed -n "${column}p")
+		printf '%26s' "$(awk -v t="$t" -v b="$base" 'BEGIN { printf "%.0f us (%.2fx)", t, b / t }')"
+	done
+	printf '\n'
+done